@@ -0,0 +1,50 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstdint>
+
+void *FrameArena::allocate(size_t bytes) {
+  for (;;) {
+    if (current_ < blocks_.size()) {
+      Block &block = blocks_[current_];
+      uintptr_t base = (uintptr_t)block.data.get();
+      size_t start = ((base + offset_ + ALIGN - 1) & ~(uintptr_t)(ALIGN - 1)) -
+                     base;
+      if (start + bytes <= block.size) {
+        offset_ = start + bytes;
+        used_ += bytes;
+        return block.data.get() + start;
+      }
+      // the rest of this block stays unused until the next frame
+      taken_ += block.size;
+      current_++;
+      offset_ = 0;
+    }
+    if (current_ == blocks_.size())
+      add_block(std::max(block_size_, bytes + ALIGN));
+  }
+}
+
+void FrameArena::reset() {
+  if (current_ < blocks_.size())
+    taken_ += offset_;
+  peak_ = std::max(peak_, taken_);
+  if (blocks_.size() > 1) {
+    blocks_.clear();
+    add_block(std::max(block_size_, peak_ + ALIGN));
+  }
+  current_ = offset_ = used_ = taken_ = 0;
+}
+
+size_t FrameArena::capacity() const {
+  size_t bytes = 0;
+  for (const Block &block : blocks_)
+    bytes += block.size;
+  return bytes;
+}
+
+void FrameArena::add_block(size_t bytes) {
+  Block block;
+  block.data.reset(new unsigned char[bytes]);
+  block.size = bytes;
+  blocks_.push_back(std::move(block));
+}
@@ -0,0 +1,63 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for memory that lives for one frame.
+//
+// Allocations are carved out of large blocks and never freed one by one; a
+// reset() makes the whole arena available again. When a frame needed more
+// than the first block, reset() replaces the blocks by a single one big
+// enough for that frame, so a steady workload stops allocating after its
+// first frame or two.
+//
+// Only trivially destructible types go in, nothing is destroyed on reset.
+// Not thread safe: allocate from the serial part of a frame and hand the
+// pieces to workers.
+class FrameArena {
+public:
+  // Every allocation starts on its own cache line, so arrays handed to
+  // different workers never share one.
+  enum { ALIGN = 64 };
+
+  explicit FrameArena(size_t block_size = 1 << 16)
+      : block_size_(block_size) {}
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  // n uninitialized objects, valid until the next reset().
+  template <class T> T *alloc(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena memory is never destroyed");
+    static_assert(alignof(T) <= ALIGN, "over aligned type");
+    return static_cast<T *>(allocate(n * sizeof(T)));
+  }
+  void *allocate(size_t bytes);
+
+  // Makes everything allocated so far available again.
+  void reset();
+
+  // Bytes handed out since the last reset, and bytes held in blocks.
+  size_t used() const { return used_; }
+  size_t capacity() const;
+
+private:
+  struct Block {
+    std::unique_ptr<unsigned char[]> data;
+    size_t size;
+  };
+  std::vector<Block> blocks_;
+  size_t block_size_;
+  size_t current_ = 0; // block allocations are bumped from
+  size_t offset_ = 0;  // first free byte in it
+  size_t used_ = 0;
+  size_t taken_ = 0; // block bytes passed over this frame, padding included
+  size_t peak_ = 0;  // most any frame took
+
+  void add_block(size_t bytes);
+};
+
+#endif //__ARENA_H__
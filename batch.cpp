@@ -0,0 +1,145 @@
+#include "batch.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+// Only ever called with a pattern valid_frame_pattern() accepted. Fails
+// rather than hand back a name cut short.
+bool frame_path(const char *pattern, int i, std::string &path) {
+  char buffer[4096];
+  int n = snprintf(buffer, sizeof(buffer), pattern, i);
+  if (n < 0 || (size_t)n >= sizeof(buffer)) {
+    std::cerr << "frame path too long for frame " << i << "\n";
+    return false;
+  }
+  path = buffer;
+  return true;
+}
+
+} // namespace
+
+bool valid_frame_pattern(const char *pattern) {
+  int numbers = 0;
+  for (const char *p = pattern; *p; p++) {
+    if (*p != '%')
+      continue;
+    if (p[1] == '%') {
+      p++;
+      continue;
+    }
+    while (p[1] >= '0' && p[1] <= '9')
+      p++;
+    if (p[1] != 'd')
+      return false;
+    p++;
+    numbers++;
+  }
+  return numbers == 1;
+}
+
+bool render_batch(const Model *model, int width, int height,
+                  const std::vector<Frame> &frames, const LodChain *lods,
+                  float lod_tolerance) {
+  const TGAColor green{0, 255, 0, 255};
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+  // Frame i renders into images[i % 2]; the encoder of frame i-2, the last
+  // user of that image, has been joined before frame i-1's was started.
+  TGAImage images[2] = {TGAImage(width, height, TGAImage::RGB),
+                        TGAImage(width, height, TGAImage::RGB)};
+  RenderContext context;
+  std::thread encoder;
+  bool ok = true, written = true;
+
+  for (size_t i = 0; i < frames.size(); i++) {
+    TGAImage &image = images[i % 2];
+    image.clear();
+    const RenderOptions &options = frames[i].options;
+    const Model *level = lods ? lods->select(width, height, options.transform,
+                                             lod_tolerance)
+                              : model;
+    mesh(level, green, image, options, context);
+
+    if (encoder.joinable()) {
+      encoder.join();
+      ok = ok && written;
+    }
+    encoder = std::thread([&image, &frames, &written, i]() {
+      image.flip_vertically();
+      written = image.write_tga_file(frames[i].path.c_str());
+    });
+  }
+  if (encoder.joinable()) {
+    encoder.join();
+    ok = ok && written;
+  }
+
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  std::cerr << "# " << frames.size() << " frames in " << seconds << " s ("
+            << (seconds > 0 ? frames.size() / seconds : 0) << " fps)"
+            << std::endl;
+  return ok;
+}
+
+bool read_camera(std::istream &in, const RenderOptions &base,
+                 RenderOptions &options) {
+  float yaw, zoom;
+  if (!(in >> yaw >> zoom))
+    return false;
+  options = base;
+  options.transform.yaw = yaw * float(M_PI) / 180.f;
+  options.transform.zoom = zoom;
+  Vec3f light;
+  if (in >> light.x >> light.y >> light.z) {
+    if (light.norm() == 0)
+      return false;
+    options.light_dir = light.normalize();
+  }
+  return true;
+}
+
+bool read_frame_list(const char *filename, const RenderOptions &base,
+                     const char *pattern, std::vector<Frame> &frames) {
+  std::ifstream in(filename);
+  if (!in.is_open()) {
+    std::cerr << "can't open file " << filename << "\n";
+    return false;
+  }
+  std::string line;
+  for (int number = 1; std::getline(in, line); number++) {
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#')
+      continue;
+    std::istringstream fields(line);
+    Frame frame;
+    if (!read_camera(fields, base, frame.options)) {
+      std::cerr << filename << ":" << number << ": bad frame\n";
+      return false;
+    }
+    if (!frame_path(pattern, (int)frames.size(), frame.path))
+      return false;
+    frames.push_back(frame);
+  }
+  return true;
+}
+
+bool turntable(int n, const RenderOptions &base, const char *pattern,
+               std::vector<Frame> &frames) {
+  frames.assign(n, Frame());
+  for (int i = 0; i < n; i++) {
+    frames[i].options = base;
+    frames[i].options.transform.yaw = 2 * float(M_PI) * i / n;
+    if (!frame_path(pattern, i, frames[i].path))
+      return false;
+  }
+  return true;
+}
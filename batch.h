@@ -0,0 +1,54 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "lod.h"
+#include "model.h"
+#include "raster.h"
+#include <istream>
+#include <string>
+#include <vector>
+
+// One frame of a batch: the options it is rendered with (placement, light and
+// the usual rasterizer knobs) and the file it is written to.
+struct Frame {
+  RenderOptions options;
+  std::string path;
+};
+
+// Renders every frame of the model to its own width*height TGA file.
+//
+// The whole batch shares two images and one set of frame buffers. Frames are
+// pipelined: while frame i is rasterized on this thread, frame i-1 is flipped
+// and encoded into its file on another, so the encode cost hides behind the
+// next render. With lods, every frame draws the level its zoom allows at
+// lod_tolerance pixels of error instead of the model. Returns false when any
+// file could not be written.
+bool render_batch(const Model *model, int width, int height,
+                  const std::vector<Frame> &frames,
+                  const LodChain *lods = nullptr, float lod_tolerance = 1);
+
+// Whether pattern names frame files safely: a printf format with exactly one
+// conversion, %d with an optional width such as %04d, and otherwise only %%.
+bool valid_frame_pattern(const char *pattern);
+
+// Reads "yaw zoom [lx ly lz]" from in, yaw in degrees and the light
+// direction optional, into options started from base. Returns false when yaw
+// and zoom are not there or the light direction is zero.
+bool read_camera(std::istream &in, const RenderOptions &base,
+                 RenderOptions &options);
+
+// Reads frame parameters, one frame per line as "yaw zoom [lx ly lz]" (yaw in
+// degrees, the light direction optional), blank lines and lines starting with
+// '#' skipped. Every frame starts from base and is named by printf'ing its
+// number into pattern, which valid_frame_pattern() must have accepted.
+// Returns false on a malformed line, a zero light direction among them, or a
+// frame name that doesn't fit.
+bool read_frame_list(const char *filename, const RenderOptions &base,
+                     const char *pattern, std::vector<Frame> &frames);
+
+// A full turn of the model about the vertical axis in n equal steps. Returns
+// false if a frame name doesn't fit.
+bool turntable(int n, const RenderOptions &base, const char *pattern,
+               std::vector<Frame> &frames);
+
+#endif //__BATCH_H__
@@ -0,0 +1,426 @@
+#include "geometry.h"
+#include "lod.h"
+#include "model.h"
+#include "raster.h"
+#include "shader.h"
+#include "tgaimage.h"
+#include "wireframe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Times each pipeline stage on its own. Every benchmark runs a few untimed
+// warmup iterations, then `reps` timed ones; the median is what rates are
+// computed from. Results go to stdout as tab separated lines, one per
+// benchmark, so runs of two versions can be diffed or loaded as a table:
+//
+//   name  reps  median_ms  min_ms  work  unit  rate  rate_unit
+//
+// A readable summary goes to stderr.
+
+namespace {
+
+const int width = 800;
+const int height = 800;
+
+// One benchmark: fn does one iteration and returns how much work it did in
+// `unit`s (triangles, pixels, bytes), which the rate is derived from.
+struct Bench {
+  std::string name;
+  std::string unit;
+  std::function<double()> fn;
+};
+
+struct Result {
+  double median_ms, min_ms, work;
+};
+
+Result run(const Bench &bench, int warmup, int reps) {
+  double work = 0;
+  for (int i = 0; i < warmup; i++)
+    work = bench.fn();
+  std::vector<double> ms(reps);
+  for (int i = 0; i < reps; i++) {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    work = bench.fn();
+    ms[i] = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  }
+  std::sort(ms.begin(), ms.end());
+  return Result{ms[reps / 2], ms[0], work};
+}
+
+// Keeps results the compiler would otherwise be free to drop.
+volatile float sink;
+
+// Random triangles with whole pixel corners inside the screen. The small ones
+// keep three distinct x, which the column fill triangle() once had needed, so
+// that their numbers compare with older runs.
+std::vector<Vec3f> random_triangles(int n, int max_size, bool distinct_x) {
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> px(0, width - 1), py(0, height - 1);
+  std::uniform_int_distribution<int> d(-max_size, max_size);
+  std::uniform_real_distribution<float> z(0.f, 1.f);
+  std::vector<Vec3f> pts;
+  while ((int)pts.size() < n * 3) {
+    int x = px(rng), y = py(rng);
+    Vec3f t[3];
+    for (int j = 0; j < 3; j++)
+      t[j] = Vec3f(std::min(width - 1, std::max(0, x + d(rng))),
+                   std::min(height - 1, std::max(0, y + d(rng))), z(rng));
+    if (distinct_x && (t[0].x == t[1].x || t[1].x == t[2].x ||
+                       t[0].x == t[2].x))
+      continue;
+    pts.insert(pts.end(), t, t + 3);
+  }
+  return pts;
+}
+
+double file_bytes(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return 0;
+  fseek(f, 0, SEEK_END);
+  double bytes = ftell(f);
+  fclose(f);
+  return bytes;
+}
+
+void usage(const char *argv0) {
+  std::cerr << "usage: " << argv0 << " [-r reps] [-w warmup] [-t threads]"
+            << " [filter]\n"
+            << "  -r  timed iterations per benchmark (default 10)\n"
+            << "  -w  untimed warmup iterations (default 2)\n"
+            << "  -t  threads for mesh(), loading and encoding (default 1)\n"
+            << "  only benchmarks whose name contains filter are run\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  int reps = 10, warmup = 2;
+  RenderOptions options;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:w:t:")) != -1) {
+    switch (opt) {
+    case 'r':
+      reps = std::max(1, std::atoi(optarg));
+      break;
+    case 'w':
+      warmup = std::max(0, std::atoi(optarg));
+      break;
+    case 't':
+      options.threads = std::atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  const char *filter = optind < argc ? argv[optind] : "";
+
+  const TGAColor white{255, 255, 255, 255};
+  TGAImage image{width, height, TGAImage::RGB};
+  std::vector<float> zbuffer(width * height);
+  auto clear_depth = [&]() {
+    std::fill(zbuffer.begin(), zbuffer.end(),
+              -std::numeric_limits<float>::max());
+  };
+
+  // line() benchmarks take two corners of each of these
+  const std::vector<Vec3f> segments = random_triangles(2000, 400, false);
+  const std::vector<Vec3f> small = random_triangles(20000, 20, true);
+  const std::vector<Vec3f> large = random_triangles(500, 200, false);
+
+  // The loader prints a line per model, keep it out of the results.
+  std::cerr.setstate(std::ios::failbit);
+  Model head{"./obj/head.obj", options.threads};
+  Model axe{"./obj/axe.obj", options.threads};
+  std::cerr.clear();
+
+  // A rendered frame for the encode and flip benchmarks to work on.
+  RenderContext context;
+  TGAImage frame{width, height, TGAImage::RGB};
+  mesh(&head, white, frame, options, context);
+  const double frame_bytes = double(width) * height * frame.get_bytespp();
+  // Encodes go to one file, decodes read a frame encoded once up front.
+  char tga_path[] = "/tmp/benchXXXXXX", rle_path[] = "/tmp/benchXXXXXX";
+  for (char *path : {tga_path, rle_path}) {
+    int fd = mkstemp(path);
+    if (fd >= 0)
+      close(fd);
+  }
+  frame.write_tga_file(rle_path);
+
+  std::vector<Bench> benches;
+  benches.push_back({"line", "px", [&]() {
+                       double px = 0;
+                       for (size_t i = 0; i < segments.size(); i += 3) {
+                         const Vec3f &a = segments[i], &b = segments[i + 1];
+                         line(image, white, int(a.x), int(a.y), int(b.x),
+                              int(b.y));
+                         px += std::max(std::abs(b.x - a.x),
+                                        std::abs(b.y - a.y));
+                       }
+                       return px;
+                     }});
+  benches.push_back({"draw_line", "px", [&]() {
+                       double px = 0;
+                       for (size_t i = 0; i < segments.size(); i += 3) {
+                         const Vec3f &a = segments[i], &b = segments[i + 1];
+                         draw_line(image, white, int(a.x), int(a.y), int(b.x),
+                                   int(b.y));
+                         px += std::max(std::abs(b.x - a.x),
+                                        std::abs(b.y - a.y)) + 1;
+                       }
+                       return px;
+                     }});
+  benches.push_back({"triangle", "tris", [&]() {
+                       for (size_t i = 0; i < small.size(); i += 3)
+                         triangle(image, white, int(small[i].x),
+                                  int(small[i].y), int(small[i + 1].x),
+                                  int(small[i + 1].y), int(small[i + 2].x),
+                                  int(small[i + 2].y));
+                       return double(small.size() / 3);
+                     }});
+  auto fills = [&](const std::vector<Vec3f> &pts) {
+    return [&pts, &image, white]() {
+      double tris = 0;
+      for (size_t i = 0; i < pts.size(); i += 3) {
+        Vec2f corners[3];
+        for (int j = 0; j < 3; j++)
+          corners[j] = Vec2f(pts[i + j].x, pts[i + j].y);
+        fill_triangle(image, white, corners);
+        tris++;
+      }
+      return tris;
+    };
+  };
+  benches.push_back({"fill_triangle/small", "tris", fills(small)});
+  benches.push_back({"fill_triangle/large", "tris", fills(large)});
+  auto triangles = [&](const std::vector<Vec3f> &pts, Rasterizer r) {
+    return [&pts, r, &image, &zbuffer, &clear_depth, white]() {
+      clear_depth();
+      RasterTarget target{&image, zbuffer.data(), width, 0, 0, width, height};
+      double px = 0;
+      for (size_t i = 0; i < pts.size(); i += 3)
+        px += draw_triangle(target, white, &pts[i], r);
+      return px;
+    };
+  };
+  benches.push_back({"triangle2/small", "px", triangles(small, BARYCENTRIC)});
+  benches.push_back({"triangle2/large", "px", triangles(large, BARYCENTRIC)});
+  benches.push_back({"triangle_edge/small", "px", triangles(small, EDGE)});
+  benches.push_back({"triangle_edge/large", "px", triangles(large, EDGE)});
+  benches.push_back({"barycentric", "px", [&]() {
+                       float acc = 0;
+                       const Vec3f *t = &large[0];
+                       for (int y = 0; y < 256; y++)
+                         for (int x = 0; x < 256; x++)
+                           acc += barycentric(t, Vec3f(x, y, 0)).x;
+                       sink = acc;
+                       return 256. * 256.;
+                     }});
+  // Vertex math on the small triangles' corners, one Vec3f at a time against
+  // eight lanes per step.
+  ModelTransform turn;
+  turn.yaw = .5f;
+  turn.zoom = .8f;
+  const Mat4 matrix = turn.matrix();
+  std::vector<Vec3f> points(small.size());
+  benches.push_back({"transform/vec3f", "verts", [&]() {
+                       for (size_t i = 0; i < small.size(); i++)
+                         points[i] = matrix.transform(small[i]);
+                       return double(small.size());
+                     }});
+  benches.push_back({"transform/vec3x8", "verts", [&]() {
+                       matrix.transform(small.data(), points.data(),
+                                        (int)small.size());
+                       return double(small.size());
+                     }});
+  benches.push_back({"normalize/vec3f", "verts", [&]() {
+                       for (size_t i = 0; i < small.size(); i++) {
+                         points[i] = small[i];
+                         points[i].normalize();
+                       }
+                       return double(small.size());
+                     }});
+  benches.push_back({"normalize/vec3x8", "verts", [&]() {
+                       const int n = (int)small.size();
+                       for (int i = 0; i + Vec3x8::LANES <= n;
+                            i += Vec3x8::LANES)
+                         Vec3x8::load(&small[i]).normalize().store(&points[i]);
+                       return double(n / Vec3x8::LANES * Vec3x8::LANES);
+                     }});
+  // The head is rendered where main() puts it. The axe sits far outside the
+  // unit cube, so it is moved and scaled to fill the screen instead.
+  RenderOptions axe_options = options;
+  {
+    Vec3f center;
+    float radius;
+    axe.bounding_sphere(center, radius);
+    axe_options.transform.zoom = radius > 0 ? 1 / radius : 1;
+    axe_options.transform.offset = center * -axe_options.transform.zoom;
+  }
+  auto render = [&](const Model &model, const RenderOptions &opts) {
+    return [&model, &opts, &image, &context, white]() {
+      image.clear();
+      mesh(&model, white, image, opts, context);
+      return double(model.nfaces());
+    };
+  };
+  benches.push_back({"mesh/head", "tris", render(head, options)});
+  benches.push_back({"mesh/axe", "tris", render(axe, axe_options)});
+  // Anti-aliased frames of the head, multisampled against the same frame
+  // drawn at twice the size each way and scaled down.
+  auto multisampled = [&](int samples) {
+    RenderOptions opts = options;
+    opts.samples = samples;
+    return [opts, &head, &image, &context, white]() {
+      image.clear();
+      mesh(&head, white, image, opts, context);
+      return double(head.nfaces());
+    };
+  };
+  benches.push_back({"mesh/head_msaa2", "tris", multisampled(2)});
+  benches.push_back({"mesh/head_msaa4", "tris", multisampled(4)});
+  benches.push_back({"mesh/head_msaa8", "tris", multisampled(8)});
+  benches.push_back({"mesh/head_ssaa4", "tris", [&]() {
+                       TGAImage big{2 * width, 2 * height, TGAImage::RGB};
+                       mesh(&head, white, big, options, context);
+                       big.scale(width, height);
+                       return double(head.nfaces());
+                     }});
+  // A head far off, a tenth of its usual size: every face against the level
+  // of detail that stays within a pixel of it.
+  RenderOptions far_options = options;
+  far_options.transform.zoom = .1f;
+  LodChain head_lods{&head, 6, .5f, 64, options.threads};
+  const Model &far_level =
+      *head_lods.select(width, height, far_options.transform);
+  benches.push_back({"mesh/head_far", "tris", render(head, far_options)});
+  benches.push_back(
+      {"mesh/head_far_lod", "tris", render(far_level, far_options)});
+  benches.push_back({"lod/head", "tris", [&]() {
+                       LodChain lods{&head, 6, .5f, 64, options.threads};
+                       sink = lods.levels();
+                       return double(head.nfaces());
+                     }});
+  TGAImage tiled{width, height, TGAImage::RGB};
+  tiled.set_tiled(true);
+  benches.push_back({"mesh/head_tiled", "tris", [&]() {
+                       tiled.clear();
+                       mesh(&head, white, tiled, options, context);
+                       return double(head.nfaces());
+                     }});
+  // The same frame through the shader pipeline, flat matching mesh/head.
+  FlatShader flat;
+  GouraudShader gouraud;
+  // A texture larger than the head ever gets on screen, so minified.
+  const TGAColor black{0, 0, 0, 255};
+  TGAImage checker{1024, 1024, TGAImage::RGB};
+  for (int y = 0; y < 1024; y++)
+    for (int x = 0; x < 1024; x++)
+      checker.set(x, y, ((x / 8) ^ (y / 8)) & 1 ? white : black);
+  Texture texture{checker};
+  TexturedShader textured{texture};
+  auto shaded = [&](auto &shader) {
+    return [&shader, &head, &options, &image, &context]() {
+      image.clear();
+      mesh_shaded(&head, shader, image, options, context);
+      return double(head.nfaces());
+    };
+  };
+  benches.push_back({"mesh_shaded/flat", "tris", shaded(flat)});
+  benches.push_back({"mesh_shaded/gouraud", "tris", shaded(gouraud)});
+  benches.push_back({"mesh_shaded/textured", "tris", shaded(textured)});
+  benches.push_back({"texture/build", "B", [&]() {
+                       Texture built{checker};
+                       sink = built.levels();
+                       return 1024. * 1024. * checker.get_bytespp();
+                     }});
+  std::vector<Edge> head_edges;
+  build_edges(&head, head_edges, options.threads);
+  benches.push_back({"build_edges/head", "tris", [&]() {
+                       std::vector<Edge> edges;
+                       build_edges(&head, edges, options.threads);
+                       return double(head.nfaces());
+                     }});
+  benches.push_back({"wireframe/head", "edges", [&]() {
+                       image.clear();
+                       wireframe(&head, head_edges, white, image, options,
+                                 context);
+                       return double(head_edges.size());
+                     }});
+  auto load = [&](const char *path) {
+    double bytes = file_bytes(path);
+    return [path, bytes, &options]() {
+      std::cerr.setstate(std::ios::failbit);
+      Model model{path, options.threads};
+      std::cerr.clear();
+      sink = model.nfaces();
+      return bytes;
+    };
+  };
+  benches.push_back({"load/head", "B", load("./obj/head.obj")});
+  benches.push_back({"load/axe", "B", load("./obj/axe.obj")});
+  auto write = [&](bool rle) {
+    return [rle, &frame, &tga_path, &options, frame_bytes]() {
+      frame.write_tga_file(tga_path, rle, options.threads);
+      return frame_bytes;
+    };
+  };
+  benches.push_back({"write_tga/rle", "B", write(true)});
+  benches.push_back({"write_tga/raw", "B", write(false)});
+  TGAImage tiled_frame = frame;
+  tiled_frame.set_tiled(true);
+  benches.push_back({"write_tga/rle_tiled", "B", [&]() {
+                       tiled_frame.write_tga_file(tga_path, true,
+                                                  options.threads);
+                       return frame_bytes;
+                     }});
+  benches.push_back({"read_tga/rle", "B", [&]() {
+                       TGAImage in;
+                       std::cerr.setstate(std::ios::failbit);
+                       in.read_tga_file(rle_path);
+                       std::cerr.clear();
+                       return frame_bytes;
+                     }});
+  benches.push_back({"flip_vertically", "B", [&]() {
+                       frame.flip_vertically();
+                       return frame_bytes;
+                     }});
+
+  printf("# name\treps\tmedian_ms\tmin_ms\twork\tunit\trate\trate_unit\n");
+  for (const Bench &bench : benches) {
+    if (!strstr(bench.name.c_str(), filter))
+      continue;
+    Result r = run(bench, warmup, reps);
+    double rate = r.median_ms > 0 ? r.work / (r.median_ms / 1000.) : 0;
+    std::string rate_unit = bench.unit + "/s";
+    if (bench.unit == "B") {
+      rate /= 1024. * 1024.;
+      rate_unit = "MB/s";
+    }
+    printf("%s\t%d\t%.4f\t%.4f\t%.0f\t%s\t%.4g\t%s\n", bench.name.c_str(),
+           reps, r.median_ms, r.min_ms, r.work, bench.unit.c_str(), rate,
+           rate_unit.c_str());
+    fflush(stdout);
+    fprintf(stderr, "%-22s %10.3f ms  %12.4g %s\n", bench.name.c_str(),
+            r.median_ms, rate, rate_unit.c_str());
+  }
+  unlink(tga_path);
+  unlink(rle_path);
+  return 0;
+}
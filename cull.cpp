@@ -0,0 +1,120 @@
+#include "cull.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+
+Visibility mesh_visibility(const Model *model, int width, int height,
+                           const ModelTransform &transform) {
+  if (!model->nverts())
+    return OUTSIDE;
+  Vec3f center;
+  float radius;
+  model->bounding_sphere(center, radius);
+  if (!transform.identity()) {
+    center = transform.apply(center);
+    radius *= std::abs(transform.zoom);
+  }
+
+  // Same mapping as world2screen(), plus a pixel of slack for its rounding.
+  float cx = (center.x + 1.f) * width / 2.f, rx = radius * width / 2.f + 1;
+  float cy = (center.y + 1.f) * height / 2.f, ry = radius * height / 2.f + 1;
+  if (cx + rx < 0 || cx - rx > width - 1 || cy + ry < 0 ||
+      cy - ry > height - 1)
+    return OUTSIDE;
+  if (cx - rx >= 0 && cx + rx <= width - 1 && cy - ry >= 0 &&
+      cy + ry <= height - 1)
+    return INSIDE;
+  return INTERSECTS;
+}
+
+bool backfacing(const Vec3f *pts) {
+  float area = (pts[2].x - pts[0].x) * (pts[1].y - pts[0].y) -
+               (pts[1].x - pts[0].x) * (pts[2].y - pts[0].y);
+  return area >= 0;
+}
+
+int guard_band(int width, int height) {
+  return std::max(0, (2047 - std::max(width, height)) / 2);
+}
+
+namespace {
+
+// One Sutherland-Hodgman pass, keeping the side where sign * (p[axis] -
+// bound) <= 0.
+int clip_polygon(const Vec3f *in, int n, Vec3f *out, int axis, float bound,
+                 float sign) {
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    const Vec3f &a = in[i], &b = in[(i + 1) % n];
+    float da = sign * (a.raw[axis] - bound), db = sign * (b.raw[axis] - bound);
+    if (da <= 0)
+      out[m++] = a;
+    if ((da < 0 && db > 0) || (da > 0 && db < 0)) {
+      float t = da / (da - db);
+      Vec3f p = a + (b - a) * t;
+      p.raw[axis] = bound;
+      p.raw[1 - axis] = std::floor(p.raw[1 - axis] + .5f);
+      out[m++] = p;
+    }
+  }
+  return m;
+}
+
+} // namespace
+
+int clip_triangle(const ScreenTriangle &tri, int width, int height,
+                  ScreenTriangle *out, int samples) {
+  const Vec3f *pts = tri.pts;
+  float minX = std::min({pts[0].x, pts[1].x, pts[2].x});
+  float maxX = std::max({pts[0].x, pts[1].x, pts[2].x});
+  float minY = std::min({pts[0].y, pts[1].y, pts[2].y});
+  float maxY = std::max({pts[0].y, pts[1].y, pts[2].y});
+
+  // The rasterizers walk [min, max) clamped to [0, size-1), so these cover
+  // nothing. Multisampling also reaches the samples of the pixels on the
+  // corners' own column and row, and those half a pixel to either side.
+  const float margin = samples > 1 ? 1 : 0;
+  if (maxX <= -margin || minX >= width - 1 + margin || maxY <= -margin ||
+      minY >= height - 1 + margin)
+    return 0;
+
+  const float g = guard_band(width, height) + margin;
+  const float lo = -g, hiX = width - 1 + g, hiY = height - 1 + g;
+  if (minX >= lo && maxX <= hiX && minY >= lo && maxY <= hiY) {
+    out[0] = tri;
+    return 1;
+  }
+
+  STAT_ADD(STAT_FACES_CLIPPED, 1);
+  // Three corners and four clip edges give at most seven corners.
+  Vec3f a[7], b[7];
+  int n = 3;
+  std::copy(pts, pts + 3, a);
+  n = clip_polygon(a, n, b, 0, lo, -1);
+  n = clip_polygon(b, n, a, 0, hiX, 1);
+  n = clip_polygon(a, n, b, 1, lo, -1);
+  n = clip_polygon(b, n, a, 1, hiY, 1);
+
+  int count = 0;
+  for (int i = 1; i + 1 < n; i++) {
+    out[count].pts[0] = a[0];
+    out[count].pts[1] = a[i];
+    out[count].pts[2] = a[i + 1];
+    out[count].color = tri.color;
+    count++;
+  }
+  return count;
+}
+
+int setup_face(const Model *model, const VertexBuffer &vertices, int i,
+               Visibility visibility, int width, int height,
+               const RenderOptions &opts, ScreenTriangle *out) {
+  ScreenTriangle tri;
+  if (!face_setup(model, vertices, i, tri.pts, tri.color, opts))
+    return 0;
+  if (visibility == INSIDE) {
+    out[0] = tri;
+    return 1;
+  }
+  return clip_triangle(tri, width, height, out, opts.samples);
+}
@@ -0,0 +1,49 @@
+#ifndef __CULL_H__
+#define __CULL_H__
+
+#include "geometry.h"
+#include "model.h"
+#include "raster.h"
+
+// Culling and clipping between triangle setup and rasterization, all in
+// screen space so it works on exactly what the rasterizer would see.
+
+// Where a whole mesh lies relative to the screen.
+enum Visibility {
+  OUTSIDE,    // nothing to draw, skip the mesh
+  INTERSECTS, // faces need clip_triangle()
+  INSIDE,     // every face is on screen, nothing to clip
+};
+
+// Classifies the model's bounding sphere, placed by transform, against the
+// width*height screen.
+Visibility mesh_visibility(const Model *model, int width, int height,
+                           const ModelTransform &transform = ModelTransform());
+
+// True for faces wound clockwise on screen, i.e. seen from behind (and for
+// degenerate ones, which cover no pixel either way).
+bool backfacing(const Vec3f *pts);
+
+// Distance past the screen edges up to which a triangle is left to the
+// rasterizer's bounding box clamp. Chosen so that anything within it stays
+// small enough for triangle_edge()'s exact integer path.
+int guard_band(int width, int height);
+
+// Drops a triangle that covers no pixel of the screen and clips one that
+// reaches past the guard band, fanning the clipped polygon back into
+// triangles. Writes the (up to five) triangles to draw to out and returns
+// how many. Clipped corners are snapped to whole pixels like world2screen()
+// output. With samples > 1 the triangle is drawn at sample positions up to
+// half a pixel past its corners, and the screen is taken a pixel wider on
+// every side.
+int clip_triangle(const ScreenTriangle &tri, int width, int height,
+                  ScreenTriangle *out, int samples = 1);
+
+// face_setup() followed by the tests above: writes what face i turns into
+// (nothing when culled, up to five triangles when clipped) to out and
+// returns how many triangles that is.
+int setup_face(const Model *model, const VertexBuffer &vertices, int i,
+               Visibility visibility, int width, int height,
+               const RenderOptions &opts, ScreenTriangle *out);
+
+#endif //__CULL_H__
@@ -0,0 +1,170 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#include "tgaimage.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Pixel storage of one compile time format, for the rasterizers' inner loops.
+//
+// TGAImage::set() takes a TGAColor carrying its size at run time, checks the
+// coordinates and copies a variable number of bytes for every pixel. Here the
+// format is a template argument (the byte layout TGAImage uses, B G R [A]), so
+// a pixel is packed once per triangle and every write is an unchecked store of
+// a known size. Callers are responsible for staying inside the image.
+//
+// With Tiled the pixels are in TGAImage's tiled layout. Writes then go to the
+// same places TGAImage::pixel() gives, with spans and masks cut where a row
+// crosses from one tile into the next.
+//
+// A Framebuffer does not own memory. Built from a TGAImage it aliases the
+// image's pixels, so whatever is drawn through it is in the image, ready for
+// write_tga_file(), without a copy.
+template <int Format, bool Tiled = false> class Framebuffer {
+public:
+  enum { BYTESPP = Format, TILE = TGAImage::TILE };
+
+  // One packed pixel in memory order, held in the low bytes.
+  typedef uint32_t Pixel;
+
+  Framebuffer(unsigned char *pixels, int width, int height)
+      : data_(pixels), width_(width), height_(height),
+        tiles_x_((width + TILE - 1) / TILE) {}
+  explicit Framebuffer(TGAImage &image)
+      : Framebuffer(image.buffer(), image.get_width(), image.get_height()) {}
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  unsigned char *at(int x, int y) const {
+    if (!Tiled)
+      return data_ + ((size_t)y * width_ + x) * BYTESPP;
+    size_t tile = (size_t)(y / TILE) * tiles_x_ + x / TILE;
+    size_t offset = tile * TILE * TILE + (y % TILE) * TILE + x % TILE;
+    return data_ + offset * BYTESPP;
+  }
+
+  static Pixel pack(const TGAColor &c) {
+    Pixel p = 0;
+    memcpy(&p, c.raw, BYTESPP);
+    return p;
+  }
+
+  void set(int x, int y, Pixel p) const { store(at(x, y), p); }
+
+  // Pixels [x0, x1) of row y.
+  void span(int x0, int x1, int y, Pixel p) const {
+    if (!Tiled) {
+      fill(at(x0, y), x1 - x0, p);
+      return;
+    }
+    while (x0 < x1) {
+      int end = std::min(x1, (x0 / TILE + 1) * TILE);
+      fill(at(x0, y), end - x0, p);
+      x0 = end;
+    }
+  }
+
+  // Pixel x + i of row y for every bit i set in mask (up to 32 lanes).
+  void set_mask(int x, int y, unsigned mask, Pixel p) const {
+    if (!Tiled) {
+      store_mask(at(x, y), mask, p);
+      return;
+    }
+    while (mask) {
+      int room = TILE - x % TILE; // lanes left in this tile's row
+      if (room >= 32) {
+        store_mask(at(x, y), mask, p);
+        return;
+      }
+      store_mask(at(x, y), mask & ((1u << room) - 1), p);
+      mask >>= room;
+      x += room;
+    }
+  }
+
+private:
+  unsigned char *data_;
+  int width_, height_;
+  int tiles_x_;
+
+  static void store(unsigned char *o, Pixel p) {
+    if (BYTESPP == 1)
+      *o = (unsigned char)p;
+    else
+      memcpy(o, &p, BYTESPP);
+  }
+
+  // n pixels from o on.
+  static void fill(unsigned char *o, int n, Pixel p) {
+    if (BYTESPP == 1) {
+      memset(o, (int)p, n);
+      return;
+    }
+    if (BYTESPP == 4) {
+      for (int i = 0; i < n; i++)
+        memcpy(o + i * 4, &p, 4);
+      return;
+    }
+    // three byte pixels: four at a time as three words, then the rest
+    uint32_t words[3];
+    for (int i = 0; i < 4; i++)
+      memcpy((unsigned char *)words + i * 3, &p, 3);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      memcpy(o + i * 3, words, 12);
+    for (; i < n; i++)
+      memcpy(o + i * 3, &p, 3);
+  }
+
+  // Pixel i from o on for every bit i set in mask.
+  static void store_mask(unsigned char *o, unsigned mask, Pixel p) {
+#if defined(__AVX2__)
+    // Eight four byte pixels go out as one masked store.
+    if (BYTESPP == 4) {
+      const __m256i lane = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+      const __m256i value = _mm256_set1_epi32((int)p);
+      for (; mask; mask >>= 8, o += 8 * BYTESPP) {
+        __m256i bits = _mm256_and_si256(_mm256_set1_epi32(mask & 0xff), lane);
+        _mm256_maskstore_epi32((int *)o, _mm256_cmpeq_epi32(bits, lane),
+                               value);
+      }
+      return;
+    }
+#endif
+    while (mask) {
+      int i = __builtin_ctz(mask);
+      mask &= mask - 1;
+      store(o + i * BYTESPP, p);
+    }
+  }
+};
+
+// Calls fn with a Framebuffer of the image's format aliasing its pixels, so a
+// templated inner loop is picked once per call instead of checked per pixel.
+template <class F> auto with_framebuffer(TGAImage &image, F fn) {
+  if (image.is_tiled()) {
+    switch (image.get_bytespp()) {
+    case TGAImage::RGBA:
+      return fn(Framebuffer<TGAImage::RGBA, true>(image));
+    case TGAImage::RGB:
+      return fn(Framebuffer<TGAImage::RGB, true>(image));
+    default:
+      return fn(Framebuffer<TGAImage::GRAYSCALE, true>(image));
+    }
+  }
+  switch (image.get_bytespp()) {
+  case TGAImage::RGBA:
+    return fn(Framebuffer<TGAImage::RGBA>(image));
+  case TGAImage::RGB:
+    return fn(Framebuffer<TGAImage::RGB>(image));
+  default:
+    return fn(Framebuffer<TGAImage::GRAYSCALE>(image));
+  }
+}
+
+#endif //__FRAMEBUFFER_H__
@@ -4,6 +4,10 @@
 #include <cmath>
 #include <iostream>
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 template <class t> struct Vec2 {
@@ -53,4 +57,175 @@ template <class t> std::ostream& operator<<(std::ostream& s, Vec3<t>& v) {
 	return s;
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Eight floats as one value, added, multiplied and divided lane by lane. The
+// halves are 16 byte vectors, which the compiler keeps in SSE registers, so
+// every operator is two instructions for all eight lanes.
+typedef float Float4 __attribute__((vector_size(16)));
+
+struct Float8 {
+	union {
+		Float4 h[2];
+		float f[8];
+	};
+	Float8() : h() {}
+	Float8(Float4 lo, Float4 hi) { h[0] = lo; h[1] = hi; }
+	// f in every lane.
+	explicit Float8(float v) { h[0] = h[1] = Float4{v, v, v, v}; }
+	float & operator [](int i)       { return f[i]; }
+	float   operator [](int i) const { return f[i]; }
+	inline Float8 operator +(const Float8 &b) const { return Float8(h[0]+b.h[0], h[1]+b.h[1]); }
+	inline Float8 operator -(const Float8 &b) const { return Float8(h[0]-b.h[0], h[1]-b.h[1]); }
+	inline Float8 operator *(const Float8 &b) const { return Float8(h[0]*b.h[0], h[1]*b.h[1]); }
+	inline Float8 operator /(const Float8 &b) const { return Float8(h[0]/b.h[0], h[1]/b.h[1]); }
+	inline Float8 operator +(float b) const { return *this + Float8(b); }
+	inline Float8 operator *(float b) const { return *this * Float8(b); }
+};
+
+inline Float8 sqrt8(Float8 a) {
+#if defined(__SSE__)
+	return Float8((Float4)_mm_sqrt_ps((__m128)a.h[0]), (Float4)_mm_sqrt_ps((__m128)a.h[1]));
+#else
+	for (int i=0; i<8; i++) a[i] = std::sqrt(a[i]);
+	return a;
+#endif
+}
+
+// Eight Vec3f in structure of arrays form: the x of every lane together, then
+// every y, then every z. The operators are Vec3f's, doing the same float
+// arithmetic in the same order on all lanes at once, so a lane comes out bit
+// for bit what the scalar code would give.
+struct Vec3x8 {
+	enum { LANES = 8 };
+	Float8 x, y, z;
+
+	Vec3x8() {}
+	Vec3x8(Float8 _x, Float8 _y, Float8 _z) : x(_x), y(_y), z(_z) {}
+	// v in every lane.
+	explicit Vec3x8(const Vec3f &v) : x(Float8(v.x)), y(Float8(v.y)), z(Float8(v.z)) {}
+
+	// Lanes from the first n (at most eight) of v, the rest zero.
+	static Vec3x8 load(const Vec3f *v, int n = LANES) {
+		Vec3x8 r;
+#if defined(__SSE__)
+		if (n == LANES) {
+			const float *p = &v[0].x;
+			for (int i=0; i<2; i++, p+=12) load4(p, r.x.h[i], r.y.h[i], r.z.h[i]);
+			return r;
+		}
+#endif
+		for (int i=0; i<n; i++) { r.x[i] = v[i].x; r.y[i] = v[i].y; r.z[i] = v[i].z; }
+		return r;
+	}
+	// The first n lanes back into v.
+	void store(Vec3f *v, int n = LANES) const {
+#if defined(__SSE__)
+		if (n == LANES) {
+			float *p = &v[0].x;
+			for (int i=0; i<2; i++, p+=12) store4(p, x.h[i], y.h[i], z.h[i]);
+			return;
+		}
+#endif
+		for (int i=0; i<n; i++) v[i] = Vec3f(x[i], y[i], z[i]);
+	}
+	Vec3f lane(int i) const { return Vec3f(x[i], y[i], z[i]); }
+
+	inline Vec3x8 operator ^(const Vec3x8 &v) const { return Vec3x8(y*v.z-z*v.y, z*v.x-x*v.z, x*v.y-y*v.x); }
+	inline Vec3x8 operator +(const Vec3x8 &v) const { return Vec3x8(x+v.x, y+v.y, z+v.z); }
+	inline Vec3x8 operator -(const Vec3x8 &v) const { return Vec3x8(x-v.x, y-v.y, z-v.z); }
+	inline Vec3x8 operator *(Float8 f)        const { return Vec3x8(x*f, y*f, z*f); }
+	inline Vec3x8 operator *(float f)         const { return *this * Float8(f); }
+	inline Float8 operator *(const Vec3x8 &v) const { return x*v.x + y*v.y + z*v.z; }
+	Float8 norm () const { return sqrt8(x*x+y*y+z*z); }
+	Vec3x8 & normalize(float l=1) { *this = (*this)*(Float8(l)/norm()); return *this; }
+
+private:
+#if defined(__SSE__)
+	// Four packed Vec3f, three vectors in memory (x0 y0 z0 x1, y1 z1 x2 y2,
+	// z2 x3 y3 z3), to and from a vector per coordinate.
+	static void load4(const float *p, Float4 &x, Float4 &y, Float4 &z) {
+		__m128 a0 = _mm_loadu_ps(p), a1 = _mm_loadu_ps(p+4), a2 = _mm_loadu_ps(p+8);
+		__m128 t = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(2,1,3,2)); // x2 y2 x3 y3
+		__m128 u = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(1,0,2,1)); // y0 z0 y1 z1
+		x = (Float4)_mm_shuffle_ps(a0, t, _MM_SHUFFLE(2,0,3,0));
+		y = (Float4)_mm_shuffle_ps(u, t, _MM_SHUFFLE(3,1,2,0));
+		z = (Float4)_mm_shuffle_ps(u, a2, _MM_SHUFFLE(3,0,3,1));
+	}
+	static void store4(float *p, Float4 x, Float4 y, Float4 z) {
+		__m128 lo = _mm_unpacklo_ps((__m128)x, (__m128)y);               // x0 y0 x1 y1
+		__m128 hi = _mm_unpackhi_ps((__m128)x, (__m128)y);               // x2 y2 x3 y3
+		__m128 m = _mm_shuffle_ps((__m128)z, (__m128)x, _MM_SHUFFLE(1,1,0,0)); // z0 z0 x1 x1
+		__m128 n = _mm_shuffle_ps((__m128)y, (__m128)z, _MM_SHUFFLE(1,1,1,1)); // y1 y1 z1 z1
+		__m128 q = _mm_shuffle_ps((__m128)z, hi, _MM_SHUFFLE(3,2,3,2));  // z2 z3 x3 y3
+		_mm_storeu_ps(p,   _mm_shuffle_ps(lo, m, _MM_SHUFFLE(2,0,1,0)));
+		_mm_storeu_ps(p+4, _mm_shuffle_ps(n, hi, _MM_SHUFFLE(1,0,2,0)));
+		_mm_storeu_ps(p+8, _mm_shuffle_ps(q, q, _MM_SHUFFLE(1,3,2,0)));
+	}
+#endif
+};
+
+// Row major 4x4 matrix acting on column vectors: p' = M p, with points taken
+// as (x, y, z, 1). M = A * B applies B first.
+struct Mat4 {
+	float m[4][4];
+
+	static Mat4 identity() {
+		Mat4 r;
+		for (int i=0; i<4; i++) for (int j=0; j<4; j++) r.m[i][j] = i==j;
+		return r;
+	}
+	static Mat4 translation(const Vec3f &v) {
+		Mat4 r = identity();
+		r.m[0][3] = v.x; r.m[1][3] = v.y; r.m[2][3] = v.z;
+		return r;
+	}
+	static Mat4 scale(float f) {
+		Mat4 r = identity();
+		r.m[0][0] = r.m[1][1] = r.m[2][2] = f;
+		return r;
+	}
+	// Turn by a radians about the y axis, taking +z towards +x.
+	static Mat4 rotation_y(float a) {
+		Mat4 r = identity();
+		float c = std::cos(a), s = std::sin(a);
+		r.m[0][0] = c;  r.m[0][2] = s;
+		r.m[2][0] = -s; r.m[2][2] = c;
+		return r;
+	}
+
+	Mat4 operator *(const Mat4 &b) const {
+		Mat4 r;
+		for (int i=0; i<4; i++)
+			for (int j=0; j<4; j++)
+				r.m[i][j] = m[i][0]*b.m[0][j] + m[i][1]*b.m[1][j] + m[i][2]*b.m[2][j] + m[i][3]*b.m[3][j];
+		return r;
+	}
+	// Whether the last row is (0, 0, 0, 1), so no divide by w is needed.
+	bool affine() const { return m[3][0]==0 && m[3][1]==0 && m[3][2]==0 && m[3][3]==1; }
+
+	// A point, divided by its w unless the matrix is affine.
+	Vec3f transform(const Vec3f &p) const {
+		Vec3f r = Vec3f(row(0, p.x, p.y, p.z), row(1, p.x, p.y, p.z), row(2, p.x, p.y, p.z));
+		return affine() ? r : r*(1.f/row(3, p.x, p.y, p.z));
+	}
+	// Eight points at once, the same arithmetic lane by lane.
+	Vec3x8 transform(const Vec3x8 &p) const {
+		Vec3x8 r = Vec3x8(row(0, p.x, p.y, p.z), row(1, p.x, p.y, p.z), row(2, p.x, p.y, p.z));
+		return affine() ? r : r*(Float8(1.f)/row(3, p.x, p.y, p.z));
+	}
+	// n points from in to out, eight per step. in and out may be the same.
+	void transform(const Vec3f *in, Vec3f *out, int n) const {
+		int i = 0;
+		for (; i+Vec3x8::LANES<=n; i+=Vec3x8::LANES)
+			transform(Vec3x8::load(in+i)).store(out+i);
+		if (i<n) transform(Vec3x8::load(in+i, n-i)).store(out+i, n-i);
+	}
+
+private:
+	template <class t> t row(int i, t x, t y, t z) const {
+		return x*m[i][0] + y*m[i][1] + z*m[i][2] + m[i][3];
+	}
+};
+
 #endif //__GEOMETRY_H__
@@ -0,0 +1,102 @@
+#include "hiz.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void HiZBuffer::reset(int x0, int y0, int w, int h) {
+  x0_ = x0, y0_ = y0, w_ = w, h_ = h;
+  blocksX_ = (w + BLOCK - 1) / BLOCK;
+  blocksY_ = (h + BLOCK - 1) / BLOCK;
+  groupsX_ = (blocksX_ + GROUP - 1) / GROUP;
+  groupsY_ = (blocksY_ + GROUP - 1) / GROUP;
+  block_.assign(blocksX_ * blocksY_, -std::numeric_limits<float>::max());
+  group_.assign(groupsX_ * groupsY_, -std::numeric_limits<float>::max());
+}
+
+int triangle_hiz(const RasterTarget &target, const TGAColor &color,
+                 const Vec3f *pts, Rasterizer rasterizer) {
+  HiZBuffer &hiz = *target.hiz;
+
+  float minX = std::min({pts[0].x, pts[1].x, pts[2].x});
+  float maxX = std::max({pts[0].x, pts[1].x, pts[2].x});
+  float minY = std::min({pts[0].y, pts[1].y, pts[2].y});
+  float maxY = std::max({pts[0].y, pts[1].y, pts[2].y});
+  minX = std::max(minX, float(target.x0));
+  minY = std::max(minY, float(target.y0));
+  maxX = std::min(maxX, float(target.x1 - 1));
+  maxY = std::min(maxY, float(target.y1 - 1));
+  if (!(minX <= maxX && minY <= maxY))
+    return 0;
+
+  // Covered pixels have barycentric weights in [0, 1], and the rasterizers
+  // sum z_i * w in this order, so no pixel can end up nearer than this.
+  float zmax = std::max(0.f, pts[0].z);
+  zmax += std::max(0.f, pts[1].z);
+  zmax += std::max(0.f, pts[2].z);
+
+  const int B = HiZBuffer::BLOCK, G = HiZBuffer::GROUP;
+  int bx0 = (int(minX) - hiz.x0_) / B;
+  int by0 = (int(minY) - hiz.y0_) / B;
+  int bx1 = (int(std::ceil(maxX)) - hiz.x0_) / B;
+  int by1 = (int(std::ceil(maxY)) - hiz.y0_) / B;
+  bx1 = std::min(bx1, hiz.blocksX_ - 1);
+  by1 = std::min(by1, hiz.blocksY_ - 1);
+
+  bool visible = false;
+  for (int gy = by0 / G; !visible && gy <= by1 / G; gy++)
+    for (int gx = bx0 / G; !visible && gx <= bx1 / G; gx++)
+      visible = hiz.group_[gy * hiz.groupsX_ + gx] < zmax;
+  if (!visible) {
+    STAT_ADD(STAT_TRIANGLES_HIZ_REJECTED, 1);
+    return 0;
+  }
+
+  int written = 0;
+  bool dirty = false;
+  for (int by = by0; by <= by1; by++) {
+    for (int bx = bx0; bx <= bx1; bx++) {
+      float &farthest = hiz.block_[by * hiz.blocksX_ + bx];
+      if (farthest >= zmax)
+        continue;
+
+      RasterTarget block = target;
+      block.hiz = nullptr;
+      block.x0 = std::max(target.x0, hiz.x0_ + bx * B);
+      block.y0 = std::max(target.y0, hiz.y0_ + by * B);
+      block.x1 = std::min(target.x1, hiz.x0_ + (bx + 1) * B);
+      block.y1 = std::min(target.y1, hiz.y0_ + (by + 1) * B);
+      block.zbuffer = target.zbuffer +
+                      (block.y0 - target.y0) * target.zstride +
+                      (block.x0 - target.x0);
+      int n = draw_triangle(block, color, pts, rasterizer);
+      if (!n)
+        continue;
+
+      written += n;
+      dirty = true;
+      float lowest = std::numeric_limits<float>::max();
+      for (int y = 0; y < block.y1 - block.y0; y++) {
+        const float *row = block.zbuffer + y * target.zstride;
+        for (int x = 0; x < block.x1 - block.x0; x++)
+          lowest = std::min(lowest, row[x]);
+      }
+      farthest = lowest;
+    }
+  }
+
+  if (dirty) {
+    for (int gy = by0 / G; gy <= by1 / G; gy++) {
+      for (int gx = bx0 / G; gx <= bx1 / G; gx++) {
+        float lowest = std::numeric_limits<float>::max();
+        int ey = std::min(hiz.blocksY_, (gy + 1) * G);
+        int ex = std::min(hiz.blocksX_, (gx + 1) * G);
+        for (int by = gy * G; by < ey; by++)
+          for (int bx = gx * G; bx < ex; bx++)
+            lowest = std::min(lowest, hiz.block_[by * hiz.blocksX_ + bx]);
+        hiz.group_[gy * hiz.groupsX_ + gx] = lowest;
+      }
+    }
+  }
+  return written;
+}
@@ -0,0 +1,42 @@
+#ifndef __HIZ_H__
+#define __HIZ_H__
+
+#include "raster.h"
+#include <vector>
+
+// Hierarchical depth buffer for early occlusion rejection.
+//
+// Shadows a window of a regular z-buffer with two coarse levels: the lowest
+// (farthest, since larger z wins) depth of every 8x8 pixel block, and the
+// lowest of those over every 8x8 group of blocks. A triangle that can not get
+// nearer than that value can not pass the depth test anywhere under it, so it
+// is dropped without looking at its pixels. Only the far bound takes part in
+// rejecting, so that is all that is kept.
+//
+// The levels are only correct while every write to the underlying z-buffer
+// goes through triangle_hiz().
+class HiZBuffer {
+public:
+  enum { BLOCK = 8, GROUP = 8 };
+
+  // Covers the w*h window at (x0, y0) whose z-buffer was just cleared.
+  void reset(int x0, int y0, int w, int h);
+
+private:
+  int x0_, y0_, w_, h_;
+  int blocksX_, blocksY_, groupsX_, groupsY_;
+  std::vector<float> block_;
+  std::vector<float> group_;
+
+  friend int triangle_hiz(const RasterTarget &target, const TGAColor &color,
+                          const Vec3f *pts, Rasterizer rasterizer);
+};
+
+// Draws a triangle with `rasterizer`, one 8x8 block at a time, skipping every
+// block the triangle can not win and the whole triangle when every group it
+// overlaps is already nearer. Writes the same pixels as the plain rasterizer
+// and returns how many.
+int triangle_hiz(const RasterTarget &target, const TGAColor &color,
+                 const Vec3f *pts, Rasterizer rasterizer);
+
+#endif //__HIZ_H__
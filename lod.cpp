@@ -0,0 +1,362 @@
+#include "lod.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <queue>
+
+namespace {
+
+// Weighted sum of squared distances to a set of planes, as the symmetric 4x4
+// matrix of the quadratic form over (x, y, z, 1). Doubles, as the terms of
+// nearly coplanar faces cancel.
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0,
+         cd = 0, d2 = 0;
+  double area = 0; // of the faces in it, for turning sums into means
+
+  // The plane ax + by + cz + d = 0, (a, b, c) of unit length.
+  void add_plane(double a, double b, double c, double d, double weight) {
+    a2 += weight * a * a, ab += weight * a * b, ac += weight * a * c;
+    ad += weight * a * d, b2 += weight * b * b, bc += weight * b * c;
+    bd += weight * b * d, c2 += weight * c * c, cd += weight * c * d;
+    d2 += weight * d * d;
+  }
+  Quadric &operator+=(const Quadric &q) {
+    a2 += q.a2, ab += q.ab, ac += q.ac, ad += q.ad, b2 += q.b2, bc += q.bc;
+    bd += q.bd, c2 += q.c2, cd += q.cd, d2 += q.d2, area += q.area;
+    return *this;
+  }
+  double operator()(const Vec3f &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+           b2 * y * y + 2 * bc * y * z + 2 * bd * y + c2 * z * z +
+           2 * cd * z + d2;
+  }
+  // Where the sum is smallest, false when that is not a single point (all
+  // planes parallel, or all through one line).
+  bool minimum(Vec3f &p) const {
+    double det = a2 * (b2 * c2 - bc * bc) - ab * (ab * c2 - bc * ac) +
+                 ac * (ab * bc - b2 * ac);
+    double scale = a2 + b2 + c2;
+    if (!(std::abs(det) > 1e-9 * scale * scale * scale))
+      return false;
+    // Cramer's rule on the upper 3x3 block against -(ad, bd, cd)
+    double x = -(ad * (b2 * c2 - bc * bc) - ab * (bd * c2 - bc * cd) +
+                 ac * (bd * bc - b2 * cd)) / det;
+    double y = -(a2 * (bd * c2 - cd * bc) - ad * (ab * c2 - bc * ac) +
+                 ac * (ab * cd - bd * ac)) / det;
+    double z = -(a2 * (b2 * cd - bc * bd) - ab * (ab * cd - bd * ac) +
+                 ad * (ab * bc - b2 * ac)) / det;
+    p = Vec3f(x, y, z);
+    return true;
+  }
+};
+
+// Weight of the planes holding an open border in place, per squared length
+// of the border edge, against face planes weighted by their area.
+const double border_weight = 100;
+
+// Faces around a vertex may not turn further than this (a cosine) when it
+// moves, which also keeps them from flipping over.
+const double min_turn = .2;
+
+// One run of edge collapses over a triangle soup, snapshot at every level.
+class Simplifier {
+public:
+  explicit Simplifier(const Model &model);
+
+  // Collapses edges until at most target faces are left, or no edge can go.
+  void reduce(int target);
+  int faces() const { return faces_; }
+  double error() const { return error_; }
+  std::unique_ptr<Model> snapshot(int threads) const;
+
+private:
+  struct Candidate {
+    double cost;
+    int a, b;
+    int version_a, version_b; // stale once either vertex changed since
+    Vec3f target;
+    bool operator<(const Candidate &c) const { return cost > c.cost; }
+  };
+
+  std::vector<Vec3f> pos_;
+  std::vector<int> tris_; // three corners per triangle
+  std::vector<char> removed_;
+  std::vector<std::vector<int>> around_; // triangles per vertex
+  std::vector<Quadric> quadrics_;
+  std::vector<int> version_;
+  std::vector<char> merged_;
+  std::priority_queue<Candidate> heap_;
+  int faces_ = 0;
+  double error_ = 0;
+
+  bool has(int t, int v) const {
+    return tris_[3 * t] == v || tris_[3 * t + 1] == v || tris_[3 * t + 2] == v;
+  }
+  void neighbors(int v, std::vector<int> &out) const;
+  void push(int a, int b);
+  bool allowed(int a, int b, const Vec3f &target) const;
+  bool turns(int v, int other, const Vec3f &target) const;
+  void collapse(const Candidate &c);
+};
+
+Simplifier::Simplifier(const Model &model)
+    : pos_(model.verts(), model.verts() + model.nverts()),
+      around_(model.nverts()), quadrics_(model.nverts()),
+      version_(model.nverts(), 0), merged_(model.nverts(), 0) {
+  const int nverts = model.nverts();
+  auto valid = [nverts](int v) { return v >= 0 && v < nverts; };
+  // Polygons as fans, the rest of the pipeline only draws their first
+  // triangle but their whole surface is what a level should look like.
+  for (int i = 0; i < model.nfaces(); i++) {
+    Face f = model.face(i);
+    for (int k = 1; k + 1 < f.size(); k++) {
+      int a = f[0], b = f[k], c = f[k + 1];
+      if (!valid(a) || !valid(b) || !valid(c) || a == b || b == c || a == c)
+        continue;
+      tris_.insert(tris_.end(), {a, b, c});
+    }
+  }
+  faces_ = (int)tris_.size() / 3;
+  removed_.assign(faces_, 0);
+
+  // Every vertex starts out with the planes of its faces.
+  std::vector<uint64_t> edges;
+  for (int t = 0; t < faces_; t++) {
+    const int *v = &tris_[3 * t];
+    Vec3f n = (pos_[v[1]] - pos_[v[0]]) ^ (pos_[v[2]] - pos_[v[0]]);
+    double length = n.norm();
+    Quadric q;
+    if (length > 0) {
+      double a = n.x / length, b = n.y / length, c = n.z / length;
+      double d = -(a * pos_[v[0]].x + b * pos_[v[0]].y + c * pos_[v[0]].z);
+      q.area = length / 2;
+      q.add_plane(a, b, c, d, q.area);
+    }
+    for (int j = 0; j < 3; j++) {
+      quadrics_[v[j]] += q;
+      around_[v[j]].push_back(t);
+      int lo = std::min(v[j], v[(j + 1) % 3]);
+      int hi = std::max(v[j], v[(j + 1) % 3]);
+      edges.push_back((uint64_t)lo << 32 | (uint32_t)hi);
+    }
+  }
+
+  // Edges of one face only are on a border. A plane through the edge, at
+  // right angles to its face, keeps collapses from pulling it inwards.
+  std::sort(edges.begin(), edges.end());
+  for (size_t i = 0; i < edges.size();) {
+    size_t j = i;
+    while (j < edges.size() && edges[j] == edges[i])
+      j++;
+    int lo = int(edges[i] >> 32), hi = int(edges[i] & 0xffffffffu);
+    if (j - i == 1) {
+      for (int t : around_[lo]) {
+        if (!has(t, hi))
+          continue;
+        const int *v = &tris_[3 * t];
+        Vec3f n = (pos_[v[1]] - pos_[v[0]]) ^ (pos_[v[2]] - pos_[v[0]]);
+        Vec3f e = pos_[hi] - pos_[lo];
+        Vec3f m = e ^ n;
+        double length = m.norm();
+        if (length > 0) {
+          double a = m.x / length, b = m.y / length, c = m.z / length;
+          double d = -(a * pos_[lo].x + b * pos_[lo].y + c * pos_[lo].z);
+          double weight = border_weight * (e * e);
+          quadrics_[lo].add_plane(a, b, c, d, weight);
+          quadrics_[hi].add_plane(a, b, c, d, weight);
+        }
+      }
+    }
+    push(lo, hi);
+    i = j;
+  }
+}
+
+void Simplifier::neighbors(int v, std::vector<int> &out) const {
+  out.clear();
+  for (int t : around_[v]) {
+    if (removed_[t])
+      continue;
+    for (int j = 0; j < 3; j++)
+      if (tris_[3 * t + j] != v)
+        out.push_back(tris_[3 * t + j]);
+  }
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+void Simplifier::push(int a, int b) {
+  Quadric q = quadrics_[a];
+  q += quadrics_[b];
+  // The best point when there is one and it stays near the edge, else the
+  // better of its ends and middle.
+  Candidate c;
+  c.a = a, c.b = b, c.version_a = version_[a], c.version_b = version_[b];
+  Vec3f mid = (pos_[a] + pos_[b]) * .5f;
+  Vec3f edge = pos_[b] - pos_[a];
+  Vec3f best;
+  if (q.minimum(best) && (best - mid) * (best - mid) <= edge * edge) {
+    c.target = best;
+    c.cost = q(best);
+  } else {
+    c.target = mid;
+    c.cost = q(mid);
+    for (const Vec3f &p : {pos_[a], pos_[b]}) {
+      double cost = q(p);
+      if (cost < c.cost)
+        c.target = p, c.cost = cost;
+    }
+  }
+  c.cost = std::max(0., c.cost);
+  heap_.push(c);
+}
+
+// True when some face around v, other than those it shares with `other`,
+// would turn too far with v moved to target.
+bool Simplifier::turns(int v, int other, const Vec3f &target) const {
+  for (int t : around_[v]) {
+    if (removed_[t] || has(t, other))
+      continue;
+    Vec3f p[3], q[3];
+    for (int j = 0; j < 3; j++) {
+      int w = tris_[3 * t + j];
+      p[j] = pos_[w];
+      q[j] = w == v ? target : pos_[w];
+    }
+    Vec3f before = (p[1] - p[0]) ^ (p[2] - p[0]);
+    Vec3f after = (q[1] - q[0]) ^ (q[2] - q[0]);
+    double dot = before * after;
+    if (!(dot > min_turn * before.norm() * after.norm()))
+      return true;
+  }
+  return false;
+}
+
+bool Simplifier::allowed(int a, int b, const Vec3f &target) const {
+  // Link condition: a and b may only share the neighbors across the faces
+  // on their edge, or the collapse pinches the surface.
+  std::vector<int> na, nb, common;
+  neighbors(a, na);
+  neighbors(b, nb);
+  std::set_intersection(na.begin(), na.end(), nb.begin(), nb.end(),
+                        std::back_inserter(common));
+  int shared = 0;
+  for (int t : around_[a])
+    shared += !removed_[t] && has(t, b);
+  if ((int)common.size() != shared)
+    return false;
+  return !turns(a, b, target) && !turns(b, a, target);
+}
+
+void Simplifier::collapse(const Candidate &c) {
+  const int a = c.a, b = c.b;
+  Quadric q = quadrics_[a];
+  q += quadrics_[b];
+  error_ = std::max(error_, std::sqrt(c.cost / std::max(q.area, 1e-30)));
+
+  pos_[a] = c.target;
+  quadrics_[a] = q;
+  merged_[b] = 1;
+  version_[a]++;
+  version_[b]++;
+  for (int t : around_[b]) {
+    if (removed_[t])
+      continue;
+    if (has(t, a)) {
+      removed_[t] = 1;
+      faces_--;
+      continue;
+    }
+    for (int j = 0; j < 3; j++)
+      if (tris_[3 * t + j] == b)
+        tris_[3 * t + j] = a;
+    around_[a].push_back(t);
+  }
+  around_[b].clear();
+  std::vector<int> &ta = around_[a];
+  ta.erase(std::remove_if(ta.begin(), ta.end(),
+                          [this](int t) { return removed_[t]; }),
+           ta.end());
+
+  std::vector<int> next;
+  neighbors(a, next);
+  for (int n : next)
+    push(std::min(a, n), std::max(a, n));
+}
+
+void Simplifier::reduce(int target) {
+  while (faces_ > target && !heap_.empty()) {
+    Candidate c = heap_.top();
+    heap_.pop();
+    if (merged_[c.a] || merged_[c.b] || version_[c.a] != c.version_a ||
+        version_[c.b] != c.version_b)
+      continue;
+    if (allowed(c.a, c.b, c.target))
+      collapse(c);
+  }
+}
+
+std::unique_ptr<Model> Simplifier::snapshot(int threads) const {
+  std::vector<int> remap(pos_.size(), -1);
+  std::vector<Vec3f> verts;
+  std::vector<int> indices;
+  indices.reserve(faces_ * 3);
+  for (size_t t = 0; t < removed_.size(); t++) {
+    if (removed_[t])
+      continue;
+    for (int j = 0; j < 3; j++) {
+      int v = tris_[3 * t + j];
+      if (remap[v] < 0) {
+        remap[v] = (int)verts.size();
+        verts.push_back(pos_[v]);
+      }
+      indices.push_back(remap[v]);
+    }
+  }
+  return std::unique_ptr<Model>(
+      new Model(std::move(verts), std::move(indices), threads));
+}
+
+} // namespace
+
+LodChain::LodChain(const Model *base, int max_levels, float ratio,
+                   int min_faces, int threads) {
+  models_.push_back(base);
+  errors_.push_back(0);
+  if (max_levels <= 1 || base->nfaces() <= min_faces)
+    return;
+
+  STAT_SCOPE(STAGE_LOAD);
+  Simplifier simplifier(*base);
+  int faces = simplifier.faces();
+  while (levels() < max_levels && faces > min_faces) {
+    simplifier.reduce(std::max(min_faces, int(faces * ratio)));
+    if (simplifier.faces() >= faces)
+      break; // nothing left that may collapse
+    faces = simplifier.faces();
+    owned_.push_back(simplifier.snapshot(threads));
+    models_.push_back(owned_.back().get());
+    errors_.push_back(float(simplifier.error()));
+  }
+}
+
+int LodChain::select(float pixels_per_unit, float tolerance) const {
+  for (int i = levels() - 1; i > 0; i--)
+    if (errors_[i] * pixels_per_unit <= tolerance)
+      return i;
+  return 0;
+}
+
+const Model *LodChain::select(int width, int height,
+                              const ModelTransform &transform,
+                              float tolerance) const {
+  // world2screen() stretches [-1, 1] over the screen, further along the
+  // longer side, where an error shows the most
+  float pixels_per_unit =
+      std::abs(transform.zoom) * std::max(width, height) / 2.f;
+  return models_[select(pixels_per_unit, tolerance)];
+}
@@ -0,0 +1,45 @@
+#ifndef __LOD_H__
+#define __LOD_H__
+
+#include "model.h"
+#include "vertex.h"
+#include <memory>
+#include <vector>
+
+// Levels of detail of a model, made by quadric error edge collapse (Garland
+// and Heckbert): edges are collapsed cheapest first, each into the point
+// nearest the planes of every face merged into it so far, until the mesh is
+// down to the face count of the next level.
+//
+// Level 0 is the model itself, each further level has about `ratio` times
+// the faces of the one before. Every level knows its error, the root mean
+// square distance of its merged vertices from the planes of the original
+// faces they stand for, at worst over all of its collapses. Open borders are
+// held in place by extra planes across them, and no collapse may turn a
+// face over. Texture coordinates and file normals are not carried over,
+// simplified levels only have positions and the normals computed from them.
+class LodChain {
+public:
+  // Builds the levels of base, which has to outlive the chain.
+  explicit LodChain(const Model *base, int max_levels = 6, float ratio = .5f,
+                    int min_faces = 64, int threads = 0);
+
+  int levels() const { return (int)models_.size(); }
+  const Model *level(int i) const { return models_[i]; }
+  float error(int i) const { return errors_[i]; }
+
+  // The coarsest level whose error stays within tolerance pixels when one
+  // model unit spans pixels_per_unit of them.
+  int select(float pixels_per_unit, float tolerance = 1) const;
+  // The same for the scale transform puts the model at on a width*height
+  // screen, see world2screen().
+  const Model *select(int width, int height, const ModelTransform &transform,
+                      float tolerance = 1) const;
+
+private:
+  std::vector<std::unique_ptr<Model>> owned_;
+  std::vector<const Model *> models_;
+  std::vector<float> errors_;
+};
+
+#endif //__LOD_H__
@@ -1,14 +1,24 @@
+#include "batch.h"
 #include "geometry.h"
+#include "lod.h"
 #include "model.h"
+#include "raster.h"
+#include "server.h"
+#include "shader.h"
+#include "stats.h"
 #include "tgaimage.h"
+#include "wireframe.h"
 #include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <limits>
+#include <string>
+#include <unistd.h>
+#include <vector>
 
 #define ARTIFACT_NAME "artifact.tga"
 #define DEBUG true
 
-void mesh(Model *model, const TGAColor &color, TGAImage &image);
-
 const TGAColor white{255, 255, 255, 255};
 const TGAColor red{255, 0, 0, 255};
 const TGAColor green{0, 255, 0, 255};
@@ -16,245 +26,19 @@ const TGAColor blue{0, 0, 255, 255};
 const int width{800};
 const int height{800};
 
-Model *model = nullptr;
-
-void swapInt(int *a, int *b) {
-  int t = *a;
-  *a = *b;
-  *b = t;
-}
-
-// Draws a line
-//
-// Where the line is represented as the following equation:
-// y = mx+c
-//
-// y1 = mx1+c
-// y2 = mx2+c
-//
-// y1-mx1 = c
-// y2     = mx2+c
-//
-// y1-mx1 = c
-// y2     = mx2+(y1-mx1)
-//
-// y1-mx1 = c
-// y2     = m(x2-x1)+y1
-//
-// y1-mx1 = c
-// y2-y1  = m(x2-x1)
-//
-//
-// y1-mx1           = c
-// (y2-y1)/(x2-x1)  = m
-void line(TGAImage &image, const TGAColor &color, int x1, int y1, int x2,
-          int y2) {
-
-  int dx = x2 - x1;
-  int dy = y2 - y1;
-
-  // m = dy/dx, mx = dy/dx*x, mx = dy*x/dx
-  // abs(dy*x) > abs(dx)
-  // therefore we do not nead to convert to float
-  // flooring with ints will suffice
-
-  // m will be dy/dx
-  // Therefore dx can not be 0, or we would divide by 0
-  if (dx != 0) {
-
-    int c = y1 - dy * x1 / dx;
-
-    if (x2 < x1)
-      swapInt(&x1, &x2);
-
-    for (int x = x1; x < x2; x++) {
-      if (0 <= x && x < width) {
-        int y = dy * x / dx + c;
-        int error = dy * (x + 1) / dx + c;
-        if (error < y)
-          swapInt(&y, &error);
-        for (int p = y; p <= error; p++) {
-          if (0 <= p && p < height) {
-            image.set(x, p, color);
-          }
-        }
-      }
-    }
-
-  } else {
-    // if dx would have been 0, then our line is vertical
-    int x = x1;
-    if (0 <= x && x < width) {
-      if (y2 < y1)
-        swapInt(&y1, &y2);
-      for (int y = y1; y < y2; y++) {
-        if (0 <= y && y < height) {
-          image.set(x, y, color);
-        }
-      }
-    }
-  }
-}
-void triangle(TGAImage &image, const TGAColor &color, int x0, int y0, int x1,
-              int y1, int x2, int y2) {
-
-  //    line(image, color, x0, y0, x1, y1);
-  //    line(image, color, x2, y2, x0, y0);
-  //    line(image, color, x1, y1, x2, y2);
-
-  if (x0 > x1) {
-    swapInt(&y0, &y1);
-    swapInt(&x0, &x1);
-  }
-  if (x1 > x2) {
-    swapInt(&y1, &y2);
-    swapInt(&x1, &x2);
-  }
-  if (x0 > x1) {
-    swapInt(&y0, &y1);
-    swapInt(&x0, &x1);
-  }
-
-  // A____b___C
-  //  \      /
-  //  c\    /a
-  //    \  /
-  //     \/
-  //      B
-  // A(x0,y0)
-  // B(x1,y1)
-  // C(x2,y2)
-  //
-
-  // slope and offsetf
-  // for line c
-  int cdy = y1 - y0;
-  int cdx = x1 - x0;
-  int cc = y0 - cdy * x0 / cdx;
-  // for ling b
-  int bdy = y2 - y0;
-  int bdx = x2 - x0;
-  int bc = y0 - bdy * x0 / bdx;
-  // for line a
-  int ady = y2 - y1;
-  int adx = x2 - x1;
-  int ac = y1 - ady * x1 / adx;
-  for (int x = x0; x < x2; x++) {
-    int rly1;
-    // A->C
-    // rly0
-    // y = dy/dx*x+c
-    int rly0 = bdy * x / bdx + bc;
-    if (x < x1) {
-      // A->B
-      // rly1
-      rly1 = cdy * x / cdx + cc;
-    } else {
-      // B->C
-      // rly1
-      rly1 = ady * x / adx + ac;
-    }
-
-    line(image, color, x, rly0, x, rly1);
-  }
-}
-
-Vec3f barycentric(const Vec3f *pts, const Vec3f P) {
-  Vec3f u = Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x) ^
-            Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y);
-  if (std::abs(u.z) < 1)
-    return Vec3f(-1, 1, 1);
-  return Vec3f(1. - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-}
-
-void triangle2(TGAImage &image, float *zbuffer, const TGAColor &color,
-               const Vec3f *pts) {
-  Vec2f boundingBoxMin(std::numeric_limits<float>::max(),
-                       std::numeric_limits<float>::max()),
-      boundingBoxMax(-std::numeric_limits<float>::max(),
-                     -std::numeric_limits<float>::max()),
-      imageBoundary(image.get_width() - 1, image.get_width() - 1);
-  for (int i = 0; i < 3; i++) {
-    boundingBoxMin.x = std::max(0.f, std::min(boundingBoxMin.x, pts[i].x));
-    boundingBoxMin.y = std::max(0.f, std::min(boundingBoxMin.y, pts[i].y));
-
-    boundingBoxMax.x =
-        std::min(imageBoundary.x, std::max(boundingBoxMax.x, pts[i].x));
-    boundingBoxMax.y =
-        std::min(imageBoundary.y, std::max(boundingBoxMax.y, pts[i].y));
-  }
-
-  Vec3f iter;
-  for (iter.x = boundingBoxMin.x; iter.x < boundingBoxMax.x; iter.x++) {
-    for (iter.y = boundingBoxMin.y; iter.y < boundingBoxMax.y; iter.y++) {
-      Vec3f barycentricP = barycentric(pts, iter);
-      if (barycentricP.x < 0 || barycentricP.y < 0 || barycentricP.z < 0)
-        continue;
-      iter.z = 0;
-      for (int i = 0; i < 3; i++) {
-        iter.z += pts[i].z * barycentricP.z;
-      }
-      if (zbuffer[int(iter.x + iter.y * width)] < iter.z) {
-        zbuffer[int(iter.x + iter.y * width)] = iter.z;
-        image.set(iter.x, iter.y, color);
-      }
-    }
-  }
-}
-Vec3f world2screen(Vec3f v) {
-  return Vec3f(int((v.x + 1.) * width / 2. + .5),
-               int((v.y + 1.) * height / 2. + .5), v.z);
-}
-void mesh(Model *model, const TGAColor &color, TGAImage &image) {
-
-  Vec3f light_dir(0, 0, -1);
-  float *zbuffer = new float[width * height];
-  for (int i = width * height; i--;
-       zbuffer[i] = -std::numeric_limits<float>::max())
-    ;
-
-  int nFaces = model->nfaces();
-  int hw = image.get_width() / 2, hh = image.get_height() / 2;
-
-  for (int i = 0; i < nFaces; i++) {
-    std::vector<int> face = model->face(i);
-
-    Vec3f vertex;
-    Vec3f world_coords[3];
-    Vec3f screen_coords[3];
-
-    for (int j = 0; j < 3; j++) {
-      vertex = model->vert(face[j]);
-      world_coords[j] = vertex;
-      screen_coords[j] = world2screen(vertex);
-    }
-
-    Vec3f normal = (world_coords[2] - world_coords[0]) ^
-                   (world_coords[1] - world_coords[0]);
-    normal.normalize();
-    float intensity = normal * light_dir;
-
-    if (intensity > 0) {
-      triangle2(
-          image, zbuffer,
-          TGAColor(intensity * 255, intensity * 255, intensity * 255, 255),
-          screen_coords);
-    }
-  }
-}
-void rasterize(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color,
-               int ybuffer[]) {
-  if (p0.x > p1.x) {
-    std::swap(p0, p1);
-  }
-  for (int x = p0.x; x <= p1.x; x++) {
-    float t = (x - p0.x) / (float)(p1.x - p0.x);
-    int y = p0.y * (1. - t) + p1.y * t;
-    if (ybuffer[x] < y) {
-      ybuffer[x] = y;
-      image.set(x, 0, color);
-    }
-  }
+const char *model_path = "./obj/head.obj";
+RenderOptions options;
+// shader for the mesh example, empty for the built in mesh() shading
+std::string shader_name;
+const char *texture_path = nullptr;
+// pixels of simplification error allowed, 0 draws every face of the model
+float lod_tolerance = 0;
+
+// The levels of detail -d draws from, just the model itself without it.
+LodChain detail_levels(const Model *model) {
+  if (lod_tolerance <= 0)
+    return LodChain{model, 1};
+  return LodChain{model, 6, .5f, 64, options.threads};
 }
 
 void exampleLines(TGAImage &image) {
@@ -266,19 +50,58 @@ void exampleLines(TGAImage &image) {
   line(image, blue, width / 2, 0, width / 2, height);
 }
 
-void exampleRaster(TGAImage &image) {
+void exampleRaster(TGAImage &image, RenderContext &context) {
   Vec3f t0[3] = {Vec3f(10, 70, 0), Vec3f(50, 160, 0), Vec3f(70, 80, 0)};
   Vec3f t1[3] = {Vec3f(180, 5, 00), Vec3f(150, 1, 0), Vec3f(70, 180, 0)};
   Vec3f t2[3] = {Vec3f(180, 1, 050), Vec3f(120, 160, 0), Vec3f(130, 180, 0)};
-  float *zb = new float[width * height];
+  context.zbuffer.assign(width * height, -std::numeric_limits<float>::max());
+  float *zb = context.zbuffer.data();
 
   triangle2(image, zb, red, t0);
   triangle2(image, zb, white, t1);
   triangle2(image, zb, green, t2);
 }
-void exampleMesh(TGAImage &image) {
-  model = new Model{"./obj/head.obj"};
-  mesh(model, green, image);
+bool exampleMesh(TGAImage &image, RenderContext &context) {
+  Model source{model_path, options.threads};
+  if (source.nfaces() == 0)
+    return false;
+  LodChain lods = detail_levels(&source);
+  const Model &model =
+      *lods.select(width, height, options.transform, lod_tolerance);
+  if (shader_name.empty()) {
+    mesh(&model, green, image, options, context);
+  } else if (shader_name == "flat") {
+    FlatShader shader{options.light_dir};
+    mesh_shaded(&model, shader, image, options, context);
+  } else if (shader_name == "gouraud") {
+    GouraudShader shader{options.light_dir};
+    mesh_shaded(&model, shader, image, options, context);
+  } else {
+    // a checkerboard stands in when no texture is given
+    TGAImage texture{64, 64, TGAImage::RGB};
+    if (!texture_path || !texture.read_tga_file(texture_path)) {
+      texture = TGAImage{64, 64, TGAImage::RGB};
+      for (int y = 0; y < 64; y++)
+        for (int x = 0; x < 64; x++)
+          texture.set(x, y, ((x / 8) ^ (y / 8)) & 1 ? white : red);
+    }
+    Texture sampler{texture};
+    TexturedShader shader{sampler, nullptr, options.light_dir};
+    mesh_shaded(&model, shader, image, options, context);
+  }
+  return true;
+}
+bool exampleWireframe(TGAImage &image, RenderContext &context) {
+  Model source{model_path, options.threads};
+  if (source.nfaces() == 0)
+    return false;
+  LodChain lods = detail_levels(&source);
+  const Model &model =
+      *lods.select(width, height, options.transform, lod_tolerance);
+  std::vector<Edge> edges;
+  build_edges(&model, edges, options.threads);
+  wireframe(&model, edges, white, image, options, context);
+  return true;
 }
 void exampleYBuffer1(TGAImage &image) {
   // scene "2d mesh"
@@ -299,39 +122,239 @@ void exampleYBuffer2(TGAImage &image) {
   rasterize(Vec2i(330, 463), Vec2i(594, 200), image, blue, ybuffer);
 }
 
+void exampleFill(TGAImage &image) {
+  // the raster example's triangles, flat and without depth
+  triangle(image, red, 10, 70, 50, 160, 70, 80);
+  triangle(image, white, 180, 5, 150, 1, 70, 180);
+  triangle(image, green, 180, 1, 120, 160, 130, 180);
+  // a fan with corners between pixels, every pixel along its shared edges
+  // filled exactly once
+  const TGAColor colors[] = {red, green, blue, white};
+  const int n = 24;
+  const Vec2f center(width * .6f + .3f, height * .5f + .7f);
+  Vec2f rim[n];
+  for (int i = 0; i < n; i++) {
+    float angle = 2 * float(M_PI) * i / n;
+    rim[i] = center + Vec2f(std::cos(angle), std::sin(angle)) * 250.f;
+  }
+  for (int i = 0; i < n; i++) {
+    const Vec2f pts[3] = {center, rim[i], rim[(i + 1) % n]};
+    fill_triangle(image, colors[i % 4], pts);
+  }
+}
+
 enum Examples {
   LINES = 0,
   RASTER = 1,
   MESH = 2,
   YBUFFER = 3,
+  WIREFRAME = 4,
+  FILL = 5,
 };
 
+void usage(const char *argv0) {
+  std::cerr << "usage: " << argv0 << " [-e example] [-t threads] [-g tile] [-r 0|1]\n"
+            << "       [-z] [-s] [-b] [-l] [-m model] [-c cache [-q]]\n"
+            << "       [-n frames | -f frame-list] [-o pattern] [-j stats]\n"
+            << "       [-p flat|gouraud|textured [-x texture]] [-d pixels]\n"
+            << "       [-a samples] [-u socket|- [-w workers]]\n"
+            << "  -e  0 lines, 1 raster, 2 mesh (default), 3 ybuffer,\n"
+            << "      4 wireframe, 5 flat 2D fill\n"
+            << "  -t  render threads, 0 for one per core (default 1)\n"
+            << "  -g  screen tile size in pixels for threaded rendering\n"
+            << "  -r  rasterizer, 0 barycentric, 1 edge functions (default)\n"
+            << "  -z  reject hidden triangles with a hierarchical z-buffer\n"
+            << "  -s  sort faces front to back before drawing\n"
+            << "  -b  cull faces wound clockwise on screen\n"
+            << "  -l  keep the image in tiles while drawing\n"
+            << "  -m  obj file or binary mesh to render (./obj/head.obj)\n"
+            << "  -c  write the model as a binary mesh cache and exit\n"
+            << "  -q  quantize cached positions to 16 bits\n"
+            << "  -n  render a turntable of this many frames of the mesh\n"
+            << "  -f  render the frames listed in a file, one per line as\n"
+            << "      \"yaw zoom [lx ly lz]\" with yaw in degrees\n"
+            << "  -o  pattern for frame files, one %d or %04d and the\n"
+            << "      like for the number (frame%04d.tga)\n"
+            << "  -j  write stage times and counters as JSON at exit\n"
+            << "  -p  shade the mesh example through a shader pipeline\n"
+            << "  -x  tga texture for -p textured (a checkerboard)\n"
+            << "  -d  draw the coarsest simplified level of the model whose\n"
+            << "      error stays under this many pixels\n"
+            << "  -a  anti-alias with 2, 4 or 8 samples per pixel\n"
+            << "  -u  serve render jobs on a Unix socket, or on stdin and\n"
+            << "      stdout for -, one per line as \"model output [yaw zoom\n"
+            << "      [lx ly lz]]\", with the other options applied to all\n"
+            << "  -w  jobs rendered at once by -u, 0 for one per core\n";
+}
+
 int main(int argc, char *argv[]) {
 
-  long eg = (long)argv[2];
+  long eg = MESH;
+  const char *cache_path = nullptr;
+  bool quantize = false;
+  int turntable_frames = 0;
+  const char *frame_list = nullptr;
+  const char *frame_pattern = "frame%04d.tga";
+  bool tiled = false;
+  const char *serve_path = nullptr;
+  int workers = 0;
+  int opt;
+  while ((opt = getopt(argc, argv,
+                       "e:t:g:r:zsblm:c:qn:f:o:j:p:x:d:a:u:w:")) != -1) {
+    switch (opt) {
+    case 'e':
+      eg = std::atol(optarg);
+      break;
+    case 't':
+      options.threads = std::atoi(optarg);
+      break;
+    case 'g':
+      options.tile_size = std::max(8, std::atoi(optarg));
+      break;
+    case 'r':
+      options.rasterizer = std::atoi(optarg) ? EDGE : BARYCENTRIC;
+      break;
+    case 'z':
+      options.hiz = true;
+      break;
+    case 's':
+      options.sort_faces = true;
+      break;
+    case 'b':
+      options.cull_backfaces = true;
+      break;
+    case 'l':
+      tiled = true;
+      break;
+    case 'm':
+      model_path = optarg;
+      break;
+    case 'c':
+      cache_path = optarg;
+      break;
+    case 'q':
+      quantize = true;
+      break;
+    case 'n':
+      turntable_frames = std::atoi(optarg);
+      break;
+    case 'f':
+      frame_list = optarg;
+      break;
+    case 'o':
+      frame_pattern = optarg;
+      if (!valid_frame_pattern(frame_pattern)) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'j':
+      stats_write_json_at_exit(optarg);
+      break;
+    case 'p':
+      shader_name = optarg;
+      if (shader_name != "flat" && shader_name != "gouraud" &&
+          shader_name != "textured") {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'x':
+      texture_path = optarg;
+      break;
+    case 'd':
+      lod_tolerance = std::max(0.f, float(std::atof(optarg)));
+      break;
+    case 'a':
+      options.samples = std::atoi(optarg);
+      if (options.samples != 1 && options.samples != 2 &&
+          options.samples != 4 && options.samples != 8) {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'u':
+      serve_path = optarg;
+      break;
+    case 'w':
+      workers = std::atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (serve_path) {
+    ServerOptions server;
+    server.width = width;
+    server.height = height;
+    server.render = options;
+    server.workers = workers;
+    server.lod_tolerance = lod_tolerance;
+    bool ok = std::string(serve_path) == "-"
+                  ? serve_stream(STDIN_FILENO, STDOUT_FILENO, server)
+                  : serve_socket(serve_path, server);
+    return ok ? 0 : 1;
+  }
+
+  if (cache_path) {
+    Model source{model_path, options.threads};
+    if (source.nfaces() == 0)
+      return 1;
+    return source.write_mesh_file(cache_path, quantize) ? 0 : 1;
+  }
+
+  if (turntable_frames > 0 || frame_list) {
+    std::vector<Frame> frames;
+    bool read = frame_list ? read_frame_list(frame_list, options,
+                                             frame_pattern, frames)
+                           : turntable(turntable_frames, options,
+                                       frame_pattern, frames);
+    if (!read)
+      return 1;
+    Model source{model_path, options.threads};
+    if (source.nfaces() == 0)
+      return 1;
+    LodChain lods = detail_levels(&source);
+    return render_batch(&source, width, height, frames, &lods, lod_tolerance)
+               ? 0
+               : 1;
+  }
+
   TGAImage image{width, height, TGAImage::RGB};
+  image.set_tiled(tiled);
+  RenderContext context;
 
+  // false when the model can't be loaded, nothing is written then
+  bool drawn = true;
   switch (eg) {
   case LINES:
     exampleLines(image);
     break;
   case RASTER:
-    exampleRaster(image);
+    exampleRaster(image, context);
     break;
   case MESH:
-    exampleMesh(image);
+    drawn = exampleMesh(image, context);
     break;
   case YBUFFER:
     exampleYBuffer2(image);
     break;
+  case WIREFRAME:
+    drawn = exampleWireframe(image, context);
+    break;
+  case FILL:
+    exampleFill(image);
+    break;
   default:
-    exampleMesh(image);
+    drawn = exampleMesh(image, context);
   }
+  if (!drawn)
+    return 1;
 
   image.flip_vertically();
-  image.write_tga_file(ARTIFACT_NAME);
-
-  delete model;
+  image.write_tga_file(ARTIFACT_NAME, true, options.threads);
 
   return 0;
 }
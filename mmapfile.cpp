@@ -0,0 +1,76 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include "mmapfile.h"
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), mapped_(false), owned_(nullptr) {
+}
+
+MappedFile::~MappedFile() {
+    release();
+}
+
+MappedFile::MappedFile(MappedFile &&other) : data_(other.data_), size_(other.size_), mapped_(other.mapped_), owned_(other.owned_) {
+    other.data_ = nullptr;
+    other.owned_ = nullptr;
+    other.size_ = 0;
+    other.mapped_ = false;
+}
+
+MappedFile & MappedFile::operator =(MappedFile &&other) {
+    if (this != &other) {
+        release();
+        data_ = other.data_;
+        size_ = other.size_;
+        mapped_ = other.mapped_;
+        owned_ = other.owned_;
+        other.data_ = nullptr;
+        other.owned_ = nullptr;
+        other.size_ = 0;
+        other.mapped_ = false;
+    }
+    return *this;
+}
+
+void MappedFile::release() {
+    if (mapped_) munmap((void *)data_, size_);
+    delete [] owned_;
+    data_ = nullptr;
+    owned_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+}
+
+bool MappedFile::open(const char *filename) {
+    release();
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            data_ = (const char *)p;
+            size_ = st.st_size;
+            mapped_ = true;
+            ::close(fd);
+            return true;
+        }
+    }
+    ::close(fd);
+
+    // Not mappable, fall back to reading it.
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) return false;
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    owned_ = new char[bytes.size() + 1];
+    std::copy(bytes.begin(), bytes.end(), owned_);
+    data_ = owned_;
+    size_ = bytes.size();
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef __MMAPFILE_H__
+#define __MMAPFILE_H__
+
+#include <cstddef>
+
+// Read only view of a whole file, memory mapped where the OS allows it and
+// read into memory otherwise (pipes, empty files). The bytes stay valid for
+// the lifetime of the object.
+class MappedFile {
+private:
+	const char *data_;
+	size_t size_;
+	bool mapped_;
+	char *owned_;
+	void release();
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(MappedFile &&other);
+	MappedFile & operator =(MappedFile &&other);
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator =(const MappedFile &) = delete;
+
+	bool open(const char *filename);
+	const char *data() const { return data_; }
+	size_t size() const { return size_; }
+	bool is_open() const { return data_ != nullptr; }
+};
+
+#endif //__MMAPFILE_H__
@@ -1,54 +1,569 @@
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <utility>
 #include <vector>
+#include <chrono>
+#include <charconv>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include "mmapfile.h"
 #include "model.h"
+#include "parallel.h"
+#include "stats.h"
+
+namespace {
+
+// Mesh files of version 1 end their header here.
+const size_t v1_header_bytes = offsetof(MeshHeader, normals);
+
+// Below this many bytes per chunk splitting the file costs more than it saves.
+const size_t min_chunk_bytes = 1 << 20;
+
+// Everything one slice of the file contributes, in file order.
+struct ObjChunk {
+    std::vector<Vec3f> verts;
+    std::vector<int> indices;      // vertex index per face corner
+    std::vector<int> face_sizes;   // corners per face
+    std::vector<size_t> relative;  // corners that used a negative index
+    std::vector<Vec2f> uvs;
+    std::vector<int> uv_indices;   // texture coordinate per corner, -1 for none
+    std::vector<size_t> relative_uvs;
+    std::vector<Vec3f> normals;
+    std::vector<int> normal_indices; // normal per corner, -1 for none
+    std::vector<size_t> relative_normals;
+};
 
-Model::Model(const char *filename) : verts_(), faces_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char *skip_blank(const char *p, const char *end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
+}
+
+inline const char *next_line(const char *p, const char *end) {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+bool parse_float(const char *&p, const char *end, float &v) {
+    p = skip_blank(p, end);
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    if (p < end && *p == '+') p++; // from_chars takes no leading plus
+    std::from_chars_result r = std::from_chars(p, end, v);
+    if (r.ec != std::errc()) return false;
+    p = r.ptr;
+    return true;
+#else
+    // strtof wants a terminated string and the mapping has none.
+    char buf[64];
+    size_t n = 0;
+    while (p + n < end && n + 1 < sizeof(buf) && !is_blank(p[n]) && p[n] != '\n') {
+        buf[n] = p[n];
+        n++;
+    }
+    buf[n] = '\0';
+    char *stop;
+    v = strtof(buf, &stop);
+    if (stop == buf) return false;
+    p += stop - buf;
+    return true;
+#endif
+}
+
+bool parse_int(const char *&p, const char *end, int &v) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    if (p == end || *p < '0' || *p > '9') return false;
+    int n = 0;
+    while (p < end && *p >= '0' && *p <= '9') n = n * 10 + (*p++ - '0');
+    v = neg ? -n : n;
+    return true;
+}
+
+void parse_chunk(const char *p, const char *end, ObjChunk &out) {
+    while (p < end) {
+        const char *eol = next_line(p, end);
+        const char *line_end = eol;
+        while (line_end > p && (line_end[-1] == '\n' || line_end[-1] == '\r')) line_end--;
+
+        if (line_end - p > 1 && p[0] == 'v' && is_blank(p[1])) {
+            const char *q = p + 2;
             Vec3f v;
-            for (int i=0;i<3;i++) iss >> v.raw[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 2, "f ")) {
-            std::vector<int> f;
-            int itrash, idx;
-            iss >> trash;
-            while (iss >> idx >> trash >> itrash >> trash >> itrash) {
-                idx--; // in wavefront obj all indices start at 1, not zero
-                f.push_back(idx);
+            bool ok = true;
+            for (int i = 0; ok && i < 3; i++) ok = parse_float(q, line_end, v.raw[i]);
+            if (ok) out.verts.push_back(v);
+        } else if (line_end - p > 2 && p[0] == 'v' && p[1] == 't' && is_blank(p[2])) {
+            // u [v [w]], w is of no use for 2D textures
+            const char *q = p + 3;
+            Vec2f uv;
+            if (parse_float(q, line_end, uv.x)) {
+                if (!parse_float(q, line_end, uv.y)) uv.y = 0;
+                out.uvs.push_back(uv);
+            }
+        } else if (line_end - p > 2 && p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+            const char *q = p + 3;
+            Vec3f n;
+            bool ok = true;
+            for (int i = 0; ok && i < 3; i++) ok = parse_float(q, line_end, n.raw[i]);
+            if (ok) out.normals.push_back(n);
+        } else if (line_end - p > 1 && p[0] == 'f' && is_blank(p[1])) {
+            // corners are v, v/vt, v//vn or v/vt/vn
+            const char *q = p + 2;
+            size_t first = out.indices.size(), first_relative = out.relative.size();
+            size_t first_relative_uv = out.relative_uvs.size();
+            size_t first_relative_normal = out.relative_normals.size();
+            int n = 0;
+            for (q = skip_blank(q, line_end); q < line_end; q = skip_blank(q, line_end)) {
+                int idx, uv = 0, vn = 0;
+                if (!parse_int(q, line_end, idx)) break;
+                if (q < line_end && *q == '/') {
+                    q++;
+                    if (!parse_int(q, line_end, uv)) uv = 0;
+                    if (q < line_end && *q == '/') {
+                        q++;
+                        if (!parse_int(q, line_end, vn)) vn = 0;
+                    }
+                }
+                while (q < line_end && !is_blank(*q)) q++;
+                if (idx < 0) {
+                    // relative to the vertices read so far, resolved after the merge
+                    out.relative.push_back(out.indices.size());
+                    idx += (int)out.verts.size();
+                } else {
+                    idx--; // in wavefront obj all indices start at 1, not zero
+                }
+                if (uv < 0) {
+                    out.relative_uvs.push_back(out.uv_indices.size());
+                    uv += (int)out.uvs.size();
+                } else {
+                    uv--; // and a missing vt becomes -1
+                }
+                if (vn < 0) {
+                    out.relative_normals.push_back(out.normal_indices.size());
+                    vn += (int)out.normals.size();
+                } else {
+                    vn--;
+                }
+                out.indices.push_back(idx);
+                out.uv_indices.push_back(uv);
+                out.normal_indices.push_back(vn);
+                n++;
+            }
+            if (n >= 3) {
+                out.face_sizes.push_back(n);
+            } else {
+                out.indices.resize(first);
+                out.uv_indices.resize(first);
+                out.normal_indices.resize(first);
+                out.relative.resize(first_relative);
+                out.relative_uvs.resize(first_relative_uv);
+                out.relative_normals.resize(first_relative_normal);
             }
-            faces_.push_back(f);
         }
+        p = eol;
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << std::endl;
 }
 
-Model::~Model() {
+} // namespace
+
+Model::Model(const char *filename, int threads) : verts_(), indices_(), offsets_(), file_(), vdata_(nullptr), nverts_(0), idata_(nullptr), nindices_(0), odata_(nullptr), nfaces_(0), uvdata_(nullptr), nuvs_(0), uvidata_(nullptr), ndata_(nullptr), nnormals_(0), nidata_(nullptr), fndata_(nullptr), vndata_(nullptr) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    STAT_SCOPE(STAGE_LOAD);
+    if (!file_.open(filename)) {
+        std::cerr << "can't open file " << filename << ": " << strerror(errno) << "\n";
+        return;
+    }
+    size_t bytes = file_.size();
+    if (bytes >= v1_header_bytes && !memcmp(file_.data(), "RMSH", 4)) {
+        if (!load_mesh_file()) {
+            std::cerr << "bad mesh file " << filename << "\n";
+            file_ = MappedFile();
+            verts_.clear();
+            vdata_ = nullptr;
+            idata_ = nullptr;
+            odata_ = nullptr;
+            uvdata_ = nullptr;
+            uvidata_ = nullptr;
+            ndata_ = nullptr;
+            nidata_ = nullptr;
+            fndata_ = vndata_ = nullptr;
+            nverts_ = nindices_ = nfaces_ = nuvs_ = nnormals_ = 0;
+            return;
+        }
+    } else {
+        load_obj_file(threads);
+        file_ = MappedFile(); // the text is not needed anymore
+    }
+    if (!fndata_) compute_normals(threads);
+
+    STAT_ADD(STAT_BYTES_LOADED, bytes);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double mb = bytes / (1024. * 1024.);
+    std::cerr << "# v# " << nverts_ << " f# "  << nfaces_
+              << " (" << mb << " MB in " << seconds * 1000 << " ms, "
+              << (seconds > 0 ? mb / seconds : 0) << " MB/s)" << std::endl;
 }
 
-int Model::nverts() {
-    return (int)verts_.size();
+Model::Model(std::vector<Vec3f> verts, std::vector<int> indices, int threads) : verts_(std::move(verts)), indices_(std::move(indices)), offsets_(), file_(), odata_(nullptr), uvdata_(nullptr), nuvs_(0), uvidata_(nullptr), ndata_(nullptr), nnormals_(0), nidata_(nullptr), fndata_(nullptr), vndata_(nullptr) {
+    vdata_ = verts_.data();
+    nverts_ = (int)verts_.size();
+    idata_ = indices_.data();
+    nindices_ = (int)indices_.size();
+    nfaces_ = nindices_ / 3;
+    compute_bbox();
+    compute_normals(threads);
 }
 
-int Model::nfaces() {
-    return (int)faces_.size();
+void Model::load_obj_file(int threads) {
+    const char *begin = file_.data(), *end = begin + file_.size();
+
+    // Cut the file into line aligned slices and parse them independently.
+    int nchunks = std::min((size_t)resolve_threads(threads), std::max((size_t)1, file_.size() / min_chunk_bytes));
+    std::vector<const char *> cuts(nchunks + 1, end);
+    cuts[0] = begin;
+    for (int c = 1; c < nchunks; c++) {
+        const char *p = begin + file_.size() * c / nchunks;
+        cuts[c] = std::max(cuts[c - 1], p < end ? next_line(p, end) : end);
+    }
+    std::vector<ObjChunk> chunks(nchunks);
+    parallel_for(nchunks, nchunks, [&](int c, int) {
+        parse_chunk(cuts[c], cuts[c + 1], chunks[c]);
+    });
+
+    // Merge in file order, shifting chunk local relative indices.
+    size_t nverts = 0, nfaces = 0, nindices = 0, nuvs = 0, nnormals = 0;
+    bool triangles = true;
+    for (const ObjChunk &chunk : chunks) {
+        nverts += chunk.verts.size();
+        nuvs += chunk.uvs.size();
+        nnormals += chunk.normals.size();
+        nfaces += chunk.face_sizes.size();
+        nindices += chunk.indices.size();
+        for (int n : chunk.face_sizes) triangles = triangles && n == 3;
+    }
+    verts_.reserve(nverts);
+    indices_.reserve(nindices);
+    if (!triangles) {
+        offsets_.reserve(nfaces + 1);
+        offsets_.push_back(0);
+    }
+    if (nuvs) {
+        uvs_.reserve(nuvs);
+        uv_indices_.reserve(nindices);
+    }
+    if (nnormals) {
+        normals_.reserve(nnormals);
+        normal_indices_.reserve(nindices);
+    }
+    for (ObjChunk &chunk : chunks) {
+        int base = (int)verts_.size();
+        for (size_t corner : chunk.relative) chunk.indices[corner] += base;
+        verts_.insert(verts_.end(), chunk.verts.begin(), chunk.verts.end());
+        indices_.insert(indices_.end(), chunk.indices.begin(), chunk.indices.end());
+        if (nuvs) {
+            int uv_base = (int)uvs_.size();
+            for (size_t corner : chunk.relative_uvs) chunk.uv_indices[corner] += uv_base;
+            uvs_.insert(uvs_.end(), chunk.uvs.begin(), chunk.uvs.end());
+            uv_indices_.insert(uv_indices_.end(), chunk.uv_indices.begin(), chunk.uv_indices.end());
+        }
+        if (nnormals) {
+            int normal_base = (int)normals_.size();
+            for (size_t corner : chunk.relative_normals) chunk.normal_indices[corner] += normal_base;
+            normals_.insert(normals_.end(), chunk.normals.begin(), chunk.normals.end());
+            normal_indices_.insert(normal_indices_.end(), chunk.normal_indices.begin(), chunk.normal_indices.end());
+        }
+        if (!triangles) {
+            for (int n : chunk.face_sizes) offsets_.push_back(offsets_.back() + n);
+        }
+    }
+
+    // Only now that relative indices are resolved can they be checked. Like
+    // the binary cache, nothing downstream bounds checks an index, so faces
+    // reaching past what the file defines are dropped here, as faces with
+    // fewer than three corners are while parsing.
+    auto in_range = [](int i, size_t n, bool optional) {
+        return (optional && i == -1) || (i >= 0 && (size_t)i < n);
+    };
+    size_t kept = 0, write = 0;
+    for (size_t f = 0; f < nfaces; f++) {
+        size_t first = triangles ? f * 3 : offsets_[f];
+        size_t last = triangles ? first + 3 : offsets_[f + 1];
+        bool valid = true;
+        for (size_t k = first; valid && k < last; k++) {
+            valid = in_range(indices_[k], nverts, false) &&
+                    (!nuvs || in_range(uv_indices_[k], nuvs, true)) &&
+                    (!nnormals || in_range(normal_indices_[k], nnormals, true));
+        }
+        if (!valid) continue;
+        for (size_t k = first; k < last; k++, write++) {
+            indices_[write] = indices_[k];
+            if (nuvs) uv_indices_[write] = uv_indices_[k];
+            if (nnormals) normal_indices_[write] = normal_indices_[k];
+        }
+        kept++;
+        if (!triangles) offsets_[kept] = (uint32_t)write;
+    }
+    if (kept < nfaces) {
+        std::cerr << "# dropped " << nfaces - kept << " faces with indices out of range\n";
+        nfaces = kept;
+        indices_.resize(write);
+        if (nuvs) uv_indices_.resize(write);
+        if (nnormals) normal_indices_.resize(write);
+        if (!triangles) offsets_.resize(kept + 1);
+    }
+
+    vdata_ = verts_.data();
+    nverts_ = (int)verts_.size();
+    idata_ = indices_.data();
+    nindices_ = (int)indices_.size();
+    odata_ = triangles ? nullptr : offsets_.data();
+    nfaces_ = (int)nfaces;
+    uvdata_ = nuvs ? uvs_.data() : nullptr;
+    nuvs_ = (int)uvs_.size();
+    uvidata_ = nuvs ? uv_indices_.data() : nullptr;
+    ndata_ = nnormals ? normals_.data() : nullptr;
+    nnormals_ = (int)normals_.size();
+    nidata_ = nnormals ? normal_indices_.data() : nullptr;
+
+    compute_bbox();
 }
 
-std::vector<int> Model::face(int idx) {
-    return faces_[idx];
+void Model::compute_bbox() {
+    if (nverts_) bbox_min_ = bbox_max_ = verts_[0];
+    for (const Vec3f &v : verts_) {
+        for (int a = 0; a < 3; a++) {
+            bbox_min_.raw[a] = std::min(bbox_min_.raw[a], v.raw[a]);
+            bbox_max_.raw[a] = std::max(bbox_max_.raw[a], v.raw[a]);
+        }
+    }
 }
 
-Vec3f Model::vert(int i) {
-    return verts_[i];
+void Model::compute_normals(int threads) {
+    // Faces in parallel: the unnormalized normal is twice the face area long,
+    // which is the weight each face gets in its vertices' normals. Polygons
+    // take the normal of their first three corners.
+    auto valid = [this](int v) { return v >= 0 && v < nverts_; };
+    std::vector<Vec3f> weighted(nfaces_);
+    face_normals_.resize(nfaces_);
+    const int faces_per_chunk = 4096;
+    parallel_for((nfaces_ + faces_per_chunk - 1) / faces_per_chunk, threads, [&](int c, int) {
+        int end = std::min(nfaces_, (c + 1) * faces_per_chunk);
+        for (int i = c * faces_per_chunk; i < end; i++) {
+            Face f = face(i);
+            Vec3f n;
+            if (valid(f[0]) && valid(f[1]) && valid(f[2])) {
+                const Vec3f &a = vdata_[f[0]];
+                n = (vdata_[f[2]] - a) ^ (vdata_[f[1]] - a);
+            }
+            weighted[i] = n;
+            face_normals_[i] = n.norm() > 0 ? n.normalize() : Vec3f();
+        }
+    });
+
+    // Vertices in parallel over a table of the faces around every vertex, in
+    // face order, so the sums come out the same on any number of threads.
+    std::vector<int> start(nverts_ + 1, 0);
+    for (int i = 0; i < nindices_; i++)
+        if (valid(idata_[i])) start[idata_[i] + 1]++;
+    for (int v = 0; v < nverts_; v++) start[v + 1] += start[v];
+    std::vector<int> around(start[nverts_]), fill(start.begin(), start.end() - 1);
+    for (int i = 0; i < nfaces_; i++)
+        for (int v : face(i))
+            if (valid(v)) around[fill[v]++] = i;
+    vertex_normals_.resize(nverts_);
+    const int verts_per_chunk = 4096;
+    parallel_for((nverts_ + verts_per_chunk - 1) / verts_per_chunk, threads, [&](int c, int) {
+        int end = std::min(nverts_, (c + 1) * verts_per_chunk);
+        for (int v = c * verts_per_chunk; v < end; v++) {
+            Vec3f n;
+            for (int k = start[v]; k < start[v + 1]; k++) n = n + weighted[around[k]];
+            vertex_normals_[v] = n.norm() > 0 ? n.normalize() : Vec3f();
+        }
+    });
+    fndata_ = face_normals_.data();
+    vndata_ = vertex_normals_.data();
 }
 
+bool Model::load_mesh_file() {
+    const char *base = file_.data();
+    size_t size = file_.size();
+    MeshHeader header;
+    memset((void *)&header, 0, sizeof(header));
+    memcpy(&header, base, v1_header_bytes);
+    if (header.version == 2) {
+        if (size < sizeof(header)) return false;
+        memcpy(&header, base, sizeof(header));
+    } else if (header.version != 1) {
+        return false;
+    }
+    bool quantized = header.flags & QUANTIZED;
+    bool triangles = header.flags & TRIANGLES;
+    if (triangles && (uint64_t)header.nfaces * 3 != header.nindices) return false;
+
+    auto fits = [size](uint64_t offset, uint64_t bytes) {
+        return offset % 16 == 0 && offset <= size && bytes <= size - offset;
+    };
+    uint64_t position_bytes = (uint64_t)header.nverts * (quantized ? 3 * sizeof(uint16_t) : sizeof(Vec3f));
+    if (!fits(header.positions, position_bytes)) return false;
+    if (!triangles && !fits(header.offsets, ((uint64_t)header.nfaces + 1) * sizeof(uint32_t))) return false;
+    if (!fits(header.indices, (uint64_t)header.nindices * sizeof(int32_t))) return false;
+    bool uvs = header.flags & UVS;
+    if (uvs && (header.nuvs > INT32_MAX || !fits(header.uvs, header.nuvs * sizeof(Vec2f)) ||
+                !fits(header.uv_indices, (uint64_t)header.nindices * sizeof(int32_t)))) return false;
+    bool normals = header.flags & NORMALS, derived = header.flags & DERIVED_NORMALS;
+    if (header.version == 1 && (normals || derived)) return false;
+    if (normals && (header.nnormals > INT32_MAX || !fits(header.normals, header.nnormals * sizeof(Vec3f)) ||
+                    !fits(header.normal_indices, (uint64_t)header.nindices * sizeof(int32_t)))) return false;
+    if (derived && (!fits(header.face_normals, (uint64_t)header.nfaces * sizeof(Vec3f)) ||
+                    !fits(header.vertex_normals, (uint64_t)header.nverts * sizeof(Vec3f)))) return false;
+    if (header.nverts > INT32_MAX || header.nfaces > INT32_MAX || header.nindices > INT32_MAX) return false;
+
+    // The sections are used in place and nothing downstream checks an index,
+    // so a damaged or hand made file is turned down here rather than read
+    // out of bounds later.
+    const int32_t *indices = (const int32_t *)(base + header.indices);
+    for (uint32_t i = 0; i < header.nindices; i++) {
+        if (indices[i] < 0 || (uint32_t)indices[i] >= header.nverts) return false;
+    }
+    if (!triangles) {
+        const uint32_t *offsets = (const uint32_t *)(base + header.offsets);
+        if (offsets[0] != 0 || offsets[header.nfaces] != header.nindices) return false;
+        for (uint32_t f = 0; f < header.nfaces; f++) {
+            if (offsets[f + 1] < offsets[f] || offsets[f + 1] - offsets[f] < 3) return false;
+        }
+    }
+    if (uvs) {
+        const int32_t *uv_indices = (const int32_t *)(base + header.uv_indices);
+        for (uint32_t i = 0; i < header.nindices; i++) {
+            // -1 marks a corner without texture coordinates
+            if (uv_indices[i] < -1 || uv_indices[i] >= (int64_t)header.nuvs) return false;
+        }
+    }
+    if (normals) {
+        const int32_t *normal_indices = (const int32_t *)(base + header.normal_indices);
+        for (uint32_t i = 0; i < header.nindices; i++) {
+            if (normal_indices[i] < -1 || normal_indices[i] >= (int64_t)header.nnormals) return false;
+        }
+    }
+
+    if (quantized) {
+        // Positions have to be expanded, the indices are still used in place.
+        const uint16_t *q = (const uint16_t *)(base + header.positions);
+        verts_.resize(header.nverts);
+        for (int a = 0; a < 3; a++) {
+            float lo = header.bbox_min[a];
+            float step = (header.bbox_max[a] - header.bbox_min[a]) / 65535.f;
+            for (uint32_t i = 0; i < header.nverts; i++) verts_[i].raw[a] = lo + q[i * 3 + a] * step;
+        }
+        vdata_ = verts_.data();
+    } else {
+        vdata_ = (const Vec3f *)(base + header.positions);
+    }
+    odata_ = triangles ? nullptr : (const uint32_t *)(base + header.offsets);
+    idata_ = (const int *)(base + header.indices);
+    nverts_ = header.nverts;
+    nindices_ = header.nindices;
+    nfaces_ = header.nfaces;
+    uvdata_ = uvs ? (const Vec2f *)(base + header.uvs) : nullptr;
+    uvidata_ = uvs ? (const int *)(base + header.uv_indices) : nullptr;
+    nuvs_ = uvs ? (int)header.nuvs : 0;
+    ndata_ = normals ? (const Vec3f *)(base + header.normals) : nullptr;
+    nidata_ = normals ? (const int *)(base + header.normal_indices) : nullptr;
+    nnormals_ = normals ? (int)header.nnormals : 0;
+    // without them the constructor works them out like for an obj file
+    fndata_ = derived ? (const Vec3f *)(base + header.face_normals) : nullptr;
+    vndata_ = derived ? (const Vec3f *)(base + header.vertex_normals) : nullptr;
+    bbox_min_ = Vec3f(header.bbox_min[0], header.bbox_min[1], header.bbox_min[2]);
+    bbox_max_ = Vec3f(header.bbox_max[0], header.bbox_max[1], header.bbox_max[2]);
+    return true;
+}
+
+bool Model::write_mesh_file(const char *filename, bool quantize) const {
+    bool triangles = odata_ == nullptr;
+
+    MeshHeader header;
+    memset((void *)&header, 0, sizeof(header));
+    memcpy(header.magic, "RMSH", 4);
+    header.version = 2;
+    bool uvs = uvidata_ != nullptr;
+    bool normals = nidata_ != nullptr;
+    header.flags = (quantize ? QUANTIZED : 0) | (triangles ? TRIANGLES : 0) | (uvs ? UVS : 0) |
+                   (normals ? NORMALS : 0) | DERIVED_NORMALS;
+    header.nverts = nverts_;
+    header.nfaces = nfaces_;
+    header.nindices = nindices_;
+    for (int a = 0; a < 3; a++) {
+        header.bbox_min[a] = bbox_min_.raw[a];
+        header.bbox_max[a] = bbox_max_.raw[a];
+    }
+
+    auto align = [](uint64_t offset) { return (offset + 15) & ~(uint64_t)15; };
+    uint64_t position_bytes = (uint64_t)nverts_ * (quantize ? 3 * sizeof(uint16_t) : sizeof(Vec3f));
+    header.positions = align(sizeof(header));
+    header.offsets = triangles ? 0 : align(header.positions + position_bytes);
+    header.indices = align(triangles ? header.positions + position_bytes : header.offsets + (nfaces_ + 1) * sizeof(uint32_t));
+
+    uint64_t end = header.indices + nindices_ * sizeof(int32_t);
+    if (uvs) {
+        header.nuvs = nuvs_;
+        header.uvs = align(end);
+        header.uv_indices = align(header.uvs + nuvs_ * sizeof(Vec2f));
+        end = header.uv_indices + nindices_ * sizeof(int32_t);
+    }
+    if (normals) {
+        header.nnormals = nnormals_;
+        header.normals = align(end);
+        header.normal_indices = align(header.normals + nnormals_ * sizeof(Vec3f));
+        end = header.normal_indices + nindices_ * sizeof(int32_t);
+    }
+    header.face_normals = align(end);
+    header.vertex_normals = align(header.face_normals + nfaces_ * sizeof(Vec3f));
+    end = header.vertex_normals + nverts_ * sizeof(Vec3f);
+
+    std::vector<char> out(end, 0);
+    memcpy(out.data(), &header, sizeof(header));
+    if (quantize) {
+        uint16_t *q = (uint16_t *)(out.data() + header.positions);
+        for (int a = 0; a < 3; a++) {
+            float range = header.bbox_max[a] - header.bbox_min[a];
+            float scale = range > 0 ? 65535.f / range : 0;
+            for (int i = 0; i < nverts_; i++) q[i * 3 + a] = (uint16_t)((vdata_[i].raw[a] - header.bbox_min[a]) * scale + .5f);
+        }
+    } else {
+        memcpy(out.data() + header.positions, vdata_, position_bytes);
+    }
+    if (!triangles) memcpy(out.data() + header.offsets, odata_, (nfaces_ + 1) * sizeof(uint32_t));
+    memcpy(out.data() + header.indices, idata_, nindices_ * sizeof(int32_t));
+    if (uvs) {
+        memcpy(out.data() + header.uvs, uvdata_, nuvs_ * sizeof(Vec2f));
+        memcpy(out.data() + header.uv_indices, uvidata_, nindices_ * sizeof(int32_t));
+    }
+    if (normals) {
+        memcpy(out.data() + header.normals, ndata_, nnormals_ * sizeof(Vec3f));
+        memcpy(out.data() + header.normal_indices, nidata_, nindices_ * sizeof(int32_t));
+    }
+    memcpy(out.data() + header.face_normals, fndata_, nfaces_ * sizeof(Vec3f));
+    memcpy(out.data() + header.vertex_normals, vndata_, nverts_ * sizeof(Vec3f));
+
+    std::ofstream file;
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    file.write(out.data(), out.size());
+    if (!file.good()) {
+        std::cerr << "can't dump the mesh file\n";
+        return false;
+    }
+    return true;
+}
+
+Model::~Model() {
+}
@@ -2,19 +2,197 @@
 #define __MODEL_H__
 
 #include <vector>
+#include <cstdint>
 #include "geometry.h"
+#include "mmapfile.h"
+
+// Binary mesh cache, see Model::write_mesh_file. Little endian, every section
+// starts 16 byte aligned at the offset the header gives for it:
+//   positions  nverts * float[3], or nverts * uint16[3] when quantized
+//   offsets    (nfaces+1) * uint32 first corner of each face, absent when
+//              every face is a triangle
+//   indices    nindices * int32 vertex index of each face corner
+//   uvs        nuvs * float[2] texture coordinates, only with the UVS flag
+//   uv_indices nindices * int32 texture coordinate of each face corner, -1
+//              for none, only with the UVS flag
+// and from version 2 on
+//   normals        nnormals * float[3] the file's vn lines, only with the
+//                  NORMALS flag
+//   normal_indices nindices * int32 normal of each face corner, -1 for none,
+//                  only with the NORMALS flag
+//   face_normals   nfaces * float[3] and
+//   vertex_normals nverts * float[3] as Model works them out, only with the
+//                  DERIVED_NORMALS flag; without it they are computed on load
+// Version 1 files, which end their header at nnormals, still load.
+#pragma pack(push,1)
+struct MeshHeader {
+	char     magic[4];       // "RMSH"
+	uint32_t version;
+	uint32_t flags;
+	uint32_t nverts;
+	uint32_t nfaces;
+	uint32_t nindices;
+	float    bbox_min[3];    // dequantization range of quantized positions
+	float    bbox_max[3];
+	uint64_t positions;
+	uint64_t offsets;
+	uint64_t indices;
+	uint64_t uvs;
+	uint64_t uv_indices;
+	uint64_t nuvs;
+	uint64_t nnormals;       // zero, and reserved, in version 1
+	uint64_t normals;
+	uint64_t normal_indices;
+	uint64_t face_normals;
+	uint64_t vertex_normals;
+	uint64_t reserved[2];    // room for more sections, zero for now
+};
+#pragma pack(pop)
+
+// The corners of one face, pointing straight into the model's index buffer.
+// Valid for as long as the model is.
+struct Face {
+	const int *idx;
+	int n;
+	int size() const { return n; }
+	const int &operator [](int i) const { return idx[i]; }
+	const int *begin() const { return idx; }
+	const int *end() const { return idx + n; }
+	operator std::vector<int>() const { return std::vector<int>(idx, idx + n); }
+};
 
 class Model {
 private:
+	// Faces live in one flat buffer of corner indices. Triangles are plain
+	// triplets; only when some face has another corner count is there an
+	// offsets table with the first corner of every face (plus one past the
+	// last).
 	std::vector<Vec3f> verts_;
-	std::vector<std::vector<int> > faces_;
+	std::vector<int> indices_;
+	std::vector<uint32_t> offsets_;
+	// Texture coordinates are indexed per corner apart from positions, as
+	// in the obj file, since a seam gives one vertex several of them.
+	std::vector<Vec2f> uvs_;
+	std::vector<int> uv_indices_;
+	// Normals from vn lines, indexed per corner like texture coordinates.
+	std::vector<Vec3f> normals_;
+	std::vector<int> normal_indices_;
+	// Computed from the positions at load time, whatever the file has,
+	// unless a binary mesh brings them along.
+	std::vector<Vec3f> face_normals_;
+	std::vector<Vec3f> vertex_normals_;
+
+	// A binary mesh is used in place: these point into the mapped file
+	// instead of the vectors above.
+	MappedFile file_;
+	const Vec3f *vdata_;
+	int nverts_;
+	const int *idata_;
+	int nindices_;
+	const uint32_t *odata_;
+	int nfaces_;
+	const Vec2f *uvdata_;
+	int nuvs_;
+	const int *uvidata_;
+	const Vec3f *ndata_;
+	int nnormals_;
+	const int *nidata_;
+	const Vec3f *fndata_;
+	const Vec3f *vndata_;
+	Vec3f bbox_min_, bbox_max_;
+
+	bool load_mesh_file();
+	void load_obj_file(int threads);
+	void compute_bbox();
+	void compute_normals(int threads);
 public:
-	Model(const char *filename);
+	enum MeshFlags {
+		QUANTIZED = 1,   // positions are 16 bit steps across the bounding box
+		TRIANGLES = 2,   // every face has three corners, no offsets section
+		UVS = 4,         // texture coordinate sections follow the indices
+		NORMALS = 8,     // vn normal sections follow, version 2 on
+		DERIVED_NORMALS = 16, // face and vertex normals follow, version 2 on
+	};
+
+	// Opens a binary mesh written by write_mesh_file, or else parses a
+	// wavefront obj file, on `threads` workers (0 for one per core) when it
+	// is large enough to be worth splitting.
+	Model(const char *filename, int threads = 0);
+	// A triangle mesh built in memory, three indices per face.
+	Model(std::vector<Vec3f> verts, std::vector<int> indices, int threads = 0);
 	~Model();
-	int nverts();
-	int nfaces();
-	Vec3f vert(int i);
-	std::vector<int> face(int idx);
+	int nverts() const { return nverts_; }
+	int nfaces() const { return nfaces_; }
+	int nindices() const { return nindices_; }
+	const Vec3f &vert(int i) const { return vdata_[i]; }
+	Face face(int idx) const {
+		if (!odata_) return Face{idata_ + idx * 3, 3};
+		return Face{idata_ + odata_[idx], int(odata_[idx + 1] - odata_[idx])};
+	}
+
+	// Position of corner j of face idx in the index buffer, which is also
+	// where per corner attributes of the face are found.
+	int corner(int idx, int j) const {
+		return (odata_ ? (int)odata_[idx] : idx * 3) + j;
+	}
+
+	// Whole buffers, for passes over every vertex or corner at once.
+	const Vec3f *verts() const { return vdata_; }
+	const int *indices() const { return idata_; }
+	// First corner of each face, nfaces()+1 entries, or null when every face
+	// is a triangle and face i simply starts at corner 3*i.
+	const uint32_t *face_offsets() const { return odata_; }
+
+	// Texture coordinates, or none when the file has no vt lines. uv_indices()
+	// runs parallel to indices(), -1 for corners without one.
+	bool has_uvs() const { return uvidata_ != nullptr; }
+	int nuvs() const { return nuvs_; }
+	const Vec2f *uvs() const { return uvdata_; }
+	const int *uv_indices() const { return uvidata_; }
+	// Texture coordinate of corner j of face idx, (0, 0) when it has none.
+	Vec2f uv(int idx, int j) const {
+		if (!uvidata_) return Vec2f();
+		int t = uvidata_[corner(idx, j)];
+		return t >= 0 && t < nuvs_ ? uvdata_[t] : Vec2f();
+	}
+
+	// Normals from the file's vn lines, or none. normal_indices() runs
+	// parallel to indices(), -1 for corners without one.
+	bool has_normals() const { return nidata_ != nullptr; }
+	int nnormals() const { return nnormals_; }
+	const Vec3f *normals() const { return ndata_; }
+	const int *normal_indices() const { return nidata_; }
+	// Normal of corner j of face idx: the file's when it has one, else the
+	// vertex normal.
+	Vec3f normal(int idx, int j) const {
+		int n = nidata_ ? nidata_[corner(idx, j)] : -1;
+		return n >= 0 && n < nnormals_ ? ndata_[n] : vndata_[face(idx)[j]];
+	}
+
+	// Unit normals worked out from the positions when the model is loaded,
+	// in parallel, for every model, or read with a binary mesh. A face's is that of the plane through
+	// its first three corners, wound like the rasterizer expects, and a
+	// vertex's the area weighted average of its faces'. Degenerate faces
+	// and vertices without faces get (0, 0, 0).
+	const Vec3f &face_normal(int idx) const { return fndata_[idx]; }
+	const Vec3f &vertex_normal(int i) const { return vndata_[i]; }
+	const Vec3f *face_normals() const { return fndata_; }
+	const Vec3f *vertex_normals() const { return vndata_; }
+
+	// Axis aligned bounds of every vertex, and the sphere around them.
+	Vec3f bbox_min() const { return bbox_min_; }
+	Vec3f bbox_max() const { return bbox_max_; }
+	void bounding_sphere(Vec3f &center, float &radius) const {
+		center = (bbox_min_ + bbox_max_) * .5f;
+		radius = (bbox_max_ - bbox_min_).norm() * .5f;
+	}
+
+	// Dumps the mesh in the binary format above, optionally with positions
+	// quantized to 16 bits per axis (a third of the size of floats, at most
+	// half a step of error). The face and vertex normals go along as worked
+	// out from the unquantized positions, so loading needs no pass over the
+	// mesh.
+	bool write_mesh_file(const char *filename, bool quantize = false) const;
 };
 
 #endif //__MODEL_H__
@@ -0,0 +1,158 @@
+#include "msaa.h"
+#include "framebuffer.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace {
+
+// Sample offsets from the pixel's center in sixteenths of a pixel, x then y:
+// the usual rotated grid patterns, which keep every sample on a row and a
+// column of its own.
+const int8_t pattern2[] = {4, 4, -4, -4};
+const int8_t pattern4[] = {-2, -6, 6, -2, -6, 2, 2, 6};
+const int8_t pattern8[] = {1, -3, -1, 3,  5, 1, -3, -5,
+                           -5, 5, -7, -1, 3, 7, 7, -7};
+
+const int8_t *pattern(int samples) {
+  return samples == 2 ? pattern2 : samples == 4 ? pattern4 : pattern8;
+}
+
+// Rows per resolve work item.
+const int rows_per_chunk = 32;
+
+// Mean of every byte lane over the samples of a pixel, the ones not in held
+// taken to be background, rounded to nearest.
+inline uint32_t average(const uint32_t *color, int samples, int shift,
+                        unsigned held, uint32_t background) {
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+  const __m128i fill = _mm_set1_epi32((int)background);
+  // channel sums of two samples side by side, eight 16 bit lanes
+  __m128i sum = zero;
+  for (int q = 0; q < samples; q += 4) {
+    __m128i v = samples == 2 ? _mm_loadl_epi64((const __m128i *)color)
+                             : _mm_loadu_si128((const __m128i *)(color + q));
+    __m128i set =
+        _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(held >> q), bit), bit);
+    v = _mm_or_si128(_mm_and_si128(set, v), _mm_andnot_si128(set, fill));
+    sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(v, zero));
+    if (samples > 2)
+      sum = _mm_add_epi16(sum, _mm_unpackhi_epi8(v, zero));
+  }
+  sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+  sum = _mm_add_epi16(sum, _mm_set1_epi16((short)(samples / 2)));
+  sum = _mm_srl_epi16(sum, _mm_cvtsi32_si128(shift));
+  return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#else
+  uint32_t out = 0;
+  for (int lane = 0; lane < 4; lane++) {
+    unsigned sum = samples / 2;
+    for (int s = 0; s < samples; s++)
+      sum += ((held >> s & 1 ? color[s] : background) >> lane * 8) & 0xff;
+    out |= (sum >> shift) << lane * 8;
+  }
+  return out;
+#endif
+}
+
+} // namespace
+
+void MultisampleBuffer::reset(int width, int height, int samples) {
+  samples_ = samples <= 2 ? 2 : samples <= 4 ? 4 : 8;
+  width_ = width;
+  height_ = height;
+  const size_t pixels = (size_t)width * height;
+  mask_.assign(pixels, 0);
+  // Samples are only ever read under their mask, what they held last frame
+  // does not matter.
+  if (depth_.size() < pixels * samples_) {
+    depth_.resize(pixels * samples_);
+    color_.resize(pixels * samples_);
+  }
+}
+
+void MultisampleBuffer::resolve_rows(TGAImage &image, int y0, int y1) const {
+  const unsigned full = (1u << samples_) - 1;
+  const int shift = samples_ == 2 ? 1 : samples_ == 4 ? 2 : 3;
+  with_framebuffer(image, [&](const auto &fb) {
+    typedef typename std::decay<decltype(fb)>::type FB;
+    for (int y = y0; y < y1; y++) {
+      const unsigned char *mask = mask_.data() + (size_t)y * width_;
+      for (int x = 0; x < width_; x++) {
+        if (!mask[x])
+          continue;
+        uint32_t background = 0;
+        if (mask[x] != full)
+          memcpy(&background, fb.at(x, y), FB::BYTESPP);
+        fb.set(x, y,
+               average(color_.data() + offset(x, y), samples_, shift, mask[x],
+                       background));
+      }
+    }
+  });
+}
+
+void MultisampleBuffer::resolve(TGAImage &image, int threads) const {
+  const int rows = std::min(height_, image.get_height());
+  const int chunks = (rows + rows_per_chunk - 1) / rows_per_chunk;
+  parallel_for(chunks, threads, [&](int chunk, int) {
+    int y0 = chunk * rows_per_chunk;
+    resolve_rows(image, y0, std::min(rows, y0 + rows_per_chunk));
+  });
+}
+
+template <int N>
+SampleTriangle<N>::SampleTriangle(float e1dx, float e1dy, float e2dx,
+                                  float e2dy, float area, float zscale)
+    : area_(area), zscale_(zscale), e1dx_(e1dx), e2dx_(e2dx) {
+  const int8_t *offsets = pattern(N);
+  min1_ = min2_ = min3_ = std::numeric_limits<float>::max();
+  for (int s = 0; s < (N < 4 ? 4 : N); s++) {
+    if (s >= N) {
+      o1_[s] = o2_[s] = -1e30f;
+      continue;
+    }
+    float dx = offsets[2 * s] / 16.f, dy = offsets[2 * s + 1] / 16.f;
+    o1_[s] = dx * e1dx + dy * e1dy;
+    o2_[s] = dx * e2dx + dy * e2dy;
+    min1_ = std::min(min1_, -o1_[s]);
+    min2_ = std::min(min2_, -o2_[s]);
+    min3_ = std::min(min3_, o1_[s] + o2_[s]);
+  }
+}
+
+template <int N>
+void SampleTriangle<N>::span(float e1, float e2, int &begin, int &end) const {
+  // Each edge function grows by a fixed step per pixel, so the pixels where
+  // it reaches its least passing value are a run cut off on one side. A
+  // pixel of slack either way keeps rounding from dropping any; the samples
+  // are tested exactly later.
+  const float e[3] = {e1, e2, area_ - e1 - e2};
+  const float step[3] = {e1dx_, e2dx_, -e1dx_ - e2dx_};
+  const float least[3] = {min1_, min2_, min3_};
+  float first = 0, last = float(end - begin - 1);
+  for (int k = 0; k < 3 && first <= last; k++) {
+    float at = (least[k] - e[k]) / step[k];
+    if (step[k] > 0)
+      first = std::max(first, std::floor(at) - 1);
+    else if (step[k] < 0)
+      last = std::min(last, std::ceil(at) + 1);
+    else if (e[k] < least[k])
+      last = -1;
+  }
+  if (first > last) {
+    end = begin;
+    return;
+  }
+  end = begin + int(last) + 1;
+  begin += int(first);
+}
+
+template class SampleTriangle<2>;
+template class SampleTriangle<4>;
+template class SampleTriangle<8>;
@@ -0,0 +1,170 @@
+#ifndef __MSAA_H__
+#define __MSAA_H__
+
+#include "tgaimage.h"
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Multisample anti-aliasing.
+//
+// Every pixel holds 2, 4 or 8 samples at fixed offsets around its center,
+// each with a depth and a color of its own. Triangles are tested for coverage
+// and depth at every sample, but shaded once per pixel, and the one color is
+// stored to whichever samples passed. resolve() then averages each pixel's
+// samples into the image, so an edge pixel comes out as the blend of what
+// covers it.
+//
+// Besides the samples a pixel keeps one byte, the mask of its samples that
+// have been written this frame. A sample outside the mask has no depth yet
+// and stands for the image's own pixel, so clearing the buffer clears only
+// the masks, and the resolve skips every pixel nothing was drawn to.
+class MultisampleBuffer {
+public:
+  enum { MAX_SAMPLES = 8 };
+
+  // Starts a frame of width*height pixels of `samples` each, rounded up to 2,
+  // 4 or 8, with nothing drawn yet.
+  void reset(int width, int height, int samples);
+  // Averages the samples of every pixel drawn to into its pixel of image,
+  // on `threads` workers.
+  void resolve(TGAImage &image, int threads = 1) const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int samples() const { return samples_; }
+
+  unsigned char *mask(int x, int y) {
+    return mask_.data() + (size_t)y * width_ + x;
+  }
+  float *depth(int x, int y) { return depth_.data() + offset(x, y); }
+  uint32_t *color(int x, int y) { return color_.data() + offset(x, y); }
+
+private:
+  int width_ = 0, height_ = 0, samples_ = 0;
+  std::vector<unsigned char> mask_;
+  std::vector<float> depth_;
+  std::vector<uint32_t> color_; // TGAColor::val, B G R A from the low byte
+
+  size_t offset(int x, int y) const {
+    return ((size_t)y * width_ + x) * samples_;
+  }
+  void resolve_rows(TGAImage &image, int y0, int y1) const;
+};
+
+// One triangle's edge functions and depth at the sample offsets of the N
+// sample pattern (2, 4 or 8), relative to a pixel's center.
+//
+// The edge functions are those of the rasterizers: e1 and e2 are both zero or
+// more inside the triangle and sum to no more than area, and depth is zscale
+// times e2 like in triangle2(). Only e1 and e2 at the pixel's center change
+// from pixel to pixel; the rest is set up once per triangle.
+template <int N> class SampleTriangle {
+public:
+  // e1 and e2 change by e1dx and e2dx from one pixel to the next along x and
+  // by e1dy and e2dy along y.
+  SampleTriangle(float e1dx, float e1dy, float e2dx, float e2dy, float area,
+                 float zscale);
+
+  // Narrows the pixels [begin, end) of a row, e1 and e2 taken at begin, to
+  // those that may have a sample inside the triangle. Leaves begin >= end
+  // when none has.
+  void span(float e1, float e2, int &begin, int &end) const;
+
+  // The mask of samples of a pixel that lie inside the triangle and are
+  // nearer than the samples of depth set in held.
+  unsigned test(float e1, float e2, unsigned held, const float *depth) const {
+    unsigned mask = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps(), area = _mm_set1_ps(area_);
+    const __m128 c1 = _mm_set1_ps(e1), c2 = _mm_set1_ps(e2);
+    for (int q = 0; q < N; q += 4) {
+      __m128 a = _mm_add_ps(c1, _mm_load_ps(o1_ + q));
+      __m128 b = _mm_add_ps(c2, _mm_load_ps(o2_ + q));
+      __m128 inside =
+          _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(a, zero), _mm_cmpge_ps(b, zero)),
+                     _mm_cmple_ps(_mm_add_ps(a, b), area));
+      __m128 hidden =
+          _mm_and_ps(lanes(held >> q), _mm_cmpnlt_ps(load(depth + q),
+                                                     depth_at(b)));
+      mask |= (unsigned)_mm_movemask_ps(_mm_andnot_ps(hidden, inside)) << q;
+    }
+#else
+    for (int s = 0; s < N; s++) {
+      float a = e1 + o1_[s], b = e2 + o2_[s];
+      if (a >= 0 && b >= 0 && a + b <= area_ &&
+          (!(held >> s & 1) || depth[s] < b * zscale_))
+        mask |= 1u << s;
+    }
+#endif
+    return mask;
+  }
+
+  // Stores pixel and the triangle's depth to the samples in mask.
+  void write(unsigned mask, float e2, float *depth, uint32_t *color,
+             uint32_t pixel) const {
+#if defined(__SSE2__)
+    // Blended whole, the vectors never reach past the pixel's own samples.
+    const __m128 c2 = _mm_set1_ps(e2);
+    const __m128 value = _mm_castsi128_ps(_mm_set1_epi32((int)pixel));
+    for (int q = 0; q < N; q += 4) {
+      __m128 set = lanes(mask >> q);
+      __m128 z = depth_at(_mm_add_ps(c2, _mm_load_ps(o2_ + q)));
+      store(depth + q, blend(set, z, load(depth + q)));
+      store((float *)color + q,
+            blend(set, value, load((const float *)color + q)));
+    }
+#else
+    for (int s = 0; s < N; s++) {
+      if (mask >> s & 1) {
+        depth[s] = (e2 + o2_[s]) * zscale_;
+        color[s] = pixel;
+      }
+    }
+#endif
+  }
+
+private:
+  float area_, zscale_;
+  float e1dx_, e2dx_;
+  // the least e1, e2 and area - e1 - e2 at a pixel's center that still let
+  // one of its samples pass the edge
+  float min1_, min2_, min3_;
+  // e1 and e2 at each sample less at the center, past the last sample far
+  // outside so that a half used vector never covers anything
+  alignas(16) float o1_[N < 4 ? 4 : N];
+  alignas(16) float o2_[N < 4 ? 4 : N];
+
+#if defined(__SSE2__)
+  __m128 depth_at(__m128 e2) const {
+    return _mm_mul_ps(e2, _mm_set1_ps(zscale_));
+  }
+  // All ones in lane i where bit i of bits is set.
+  static __m128 lanes(unsigned bits) {
+    const __m128i bit = _mm_setr_epi32(1, 2, 4, 8);
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(_mm_set1_epi32((int)bits), bit), bit));
+  }
+  static __m128 blend(__m128 set, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(set, a), _mm_andnot_ps(set, b));
+  }
+  // A pixel's samples from p on, with two of them only half a vector that
+  // must not touch its neighbour's.
+  static __m128 load(const float *p) {
+    if (N == 2)
+      return _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)p));
+    return _mm_loadu_ps(p);
+  }
+  static void store(float *p, __m128 v) {
+    if (N == 2)
+      _mm_storel_epi64((__m128i *)p, _mm_castps_si128(v));
+    else
+      _mm_storeu_ps(p, v);
+  }
+#endif
+};
+
+#endif //__MSAA_H__
@@ -0,0 +1,60 @@
+#include "parallel.h"
+
+ThreadPool &ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = true;
+  }
+  wake_.notify_all();
+  for (std::thread &thread : threads_)
+    thread.join();
+}
+
+void ThreadPool::run(Job &job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while ((int)threads_.size() < job.threads - 1)
+      threads_.emplace_back([this]() { loop(); });
+    jobs_.push_back(&job);
+  }
+  wake_.notify_all();
+  work(job, 0);
+
+  // Every item has been handed out; wait for the pooled threads still on
+  // one of them, and make sure no other joins after this returns.
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto open = std::find(jobs_.begin(), jobs_.end(), &job);
+  if (open != jobs_.end())
+    jobs_.erase(open);
+  done_.wait(lock, [&job]() { return job.active == 0; });
+}
+
+void ThreadPool::loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this]() { return closing_ || !jobs_.empty(); });
+    if (jobs_.empty())
+      return;
+    Job &job = *jobs_.front();
+    // A job stays open until it has all its workers or nothing left to hand
+    // out, whichever comes first.
+    if (job.next >= job.n) {
+      jobs_.pop_front();
+      continue;
+    }
+    int worker = job.joined++;
+    if (job.joined == job.threads)
+      jobs_.pop_front();
+    job.active++;
+    lock.unlock();
+    work(job, worker);
+    lock.lock();
+    if (--job.active == 0)
+      done_.notify_all();
+  }
+}
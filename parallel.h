@@ -0,0 +1,88 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Turns a user supplied thread count into a real one, 0 (or anything below)
+// meaning one worker per hardware thread.
+inline int resolve_threads(int threads) {
+  if (threads > 0)
+    return threads;
+  int hw = (int)std::thread::hardware_concurrency();
+  return hw > 0 ? hw : 1;
+}
+
+// The threads behind parallel_for, started on first use and kept until the
+// process exits, so a call costs a wakeup instead of a thread start and join
+// per worker. The pool grows to the most workers any call has asked for.
+//
+// Any number of threads may run jobs at once, a job also from inside another.
+// Pooled threads busy elsewhere simply don't join a job; its caller works
+// through whatever is left on its own, so no job ever waits for a free thread.
+class ThreadPool {
+public:
+  // One parallel_for call. Items go out one at a time through next.
+  struct Job {
+    int n, threads;
+    void (*call)(void *fn, int item, int worker);
+    void *fn;
+    std::atomic<int> next{0};
+    // under the pool's mutex: workers that have joined, the caller included,
+    // and pooled threads still working on the job
+    int joined = 1, active = 0;
+  };
+
+  static ThreadPool &shared();
+  ~ThreadPool();
+
+  // Works on job as worker 0 on the calling thread, with up to
+  // job.threads - 1 pooled threads. Returns once every item is done.
+  void run(Job &job);
+
+private:
+  std::mutex mutex_;
+  std::condition_variable wake_, done_;
+  std::deque<Job *> jobs_; // open to more workers, oldest first
+  std::vector<std::thread> threads_;
+  bool closing_ = false;
+
+  void loop();
+  static void work(Job &job, int worker) {
+    for (int i = job.next++; i < job.n; i = job.next++)
+      job.call(job.fn, i, worker);
+  }
+};
+
+// Calls fn(item, worker) for every item in [0, n) on up to `threads` workers.
+//
+// Items are handed out one at a time through a shared counter, so uneven
+// items (dense screen tiles next to empty ones) still balance. The calling
+// thread is worker 0 and takes part in the work, so threads == 1 runs inline
+// without touching the pool. `worker` is stable for the duration of a call
+// and lies in [0, threads), which lets callers keep per-worker scratch
+// memory; with the pool busy a call may see fewer workers than it asked for.
+template <class F> void parallel_for(int n, int threads, F fn) {
+  threads = std::min(resolve_threads(threads), n);
+  if (threads <= 1) {
+    for (int i = 0; i < n; i++)
+      fn(i, 0);
+    return;
+  }
+
+  ThreadPool::Job job;
+  job.n = n;
+  job.threads = threads;
+  job.fn = &fn;
+  job.call = [](void *f, int item, int worker) {
+    (*static_cast<F *>(f))(item, worker);
+  };
+  ThreadPool::shared().run(job);
+}
+
+#endif //__PARALLEL_H__
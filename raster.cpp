@@ -0,0 +1,308 @@
+#include "raster.h"
+#include "cull.h"
+#include "framebuffer.h"
+#include "hiz.h"
+#include "shader.h"
+#include "stats.h"
+#include "tiled.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+void swapInt(int *a, int *b) {
+  int t = *a;
+  *a = *b;
+  *b = t;
+}
+
+// Draws a line
+//
+// Where the line is represented as the following equation:
+// y = mx+c
+//
+// y1 = mx1+c
+// y2 = mx2+c
+//
+// y1-mx1 = c
+// y2     = mx2+c
+//
+// y1-mx1 = c
+// y2     = mx2+(y1-mx1)
+//
+// y1-mx1 = c
+// y2     = m(x2-x1)+y1
+//
+// y1-mx1 = c
+// y2-y1  = m(x2-x1)
+//
+//
+// y1-mx1           = c
+// (y2-y1)/(x2-x1)  = m
+void line(TGAImage &image, const TGAColor &color, int x1, int y1, int x2,
+          int y2) {
+
+  const int width = image.get_width();
+  const int height = image.get_height();
+  int dx = x2 - x1;
+  int dy = y2 - y1;
+
+  // m = dy/dx, mx = dy/dx*x, mx = dy*x/dx
+  // abs(dy*x) > abs(dx)
+  // therefore we do not nead to convert to float
+  // flooring with ints will suffice
+
+  // m will be dy/dx
+  // Therefore dx can not be 0, or we would divide by 0
+  if (dx != 0) {
+
+    int c = y1 - dy * x1 / dx;
+
+    if (x2 < x1)
+      swapInt(&x1, &x2);
+
+    for (int x = x1; x < x2; x++) {
+      if (0 <= x && x < width) {
+        int y = dy * x / dx + c;
+        int error = dy * (x + 1) / dx + c;
+        if (error < y)
+          swapInt(&y, &error);
+        for (int p = y; p <= error; p++) {
+          if (0 <= p && p < height) {
+            image.set(x, p, color);
+          }
+        }
+      }
+    }
+
+  } else {
+    // if dx would have been 0, then our line is vertical
+    int x = x1;
+    if (0 <= x && x < width) {
+      if (y2 < y1)
+        swapInt(&y1, &y2);
+      for (int y = y1; y < y2; y++) {
+        if (0 <= y && y < height) {
+          image.set(x, y, color);
+        }
+      }
+    }
+  }
+}
+void triangle(TGAImage &image, const TGAColor &color, int x0, int y0, int x1,
+              int y1, int x2, int y2) {
+  const Vec2f pts[3] = {Vec2f(x0, y0), Vec2f(x1, y1), Vec2f(x2, y2)};
+  fill_triangle(image, color, pts);
+}
+
+Vec3f barycentric(const Vec3f *pts, const Vec3f P) {
+  Vec3f u = Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x) ^
+            Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y);
+  if (std::abs(u.z) < 1)
+    return Vec3f(-1, 1, 1);
+  return Vec3f(1. - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+}
+
+void triangle2(TGAImage &image, float *zbuffer, const TGAColor &color,
+               const Vec3f *pts) {
+  RasterTarget target{&image,           zbuffer, image.get_width(), 0, 0,
+                      image.get_width(), image.get_height()};
+  triangle2(target, color, pts);
+}
+
+namespace {
+
+template <class FB>
+int barycentric_fill(const RasterTarget &target, const FB &fb,
+                     const TGAColor &color, const Vec3f *pts) {
+  Vec2f boundingBoxMin(std::numeric_limits<float>::max(),
+                       std::numeric_limits<float>::max()),
+      boundingBoxMax(-std::numeric_limits<float>::max(),
+                     -std::numeric_limits<float>::max()),
+      imageBoundary(fb.width() - 1, fb.height() - 1);
+  const typename FB::Pixel pixel = FB::pack(color);
+  for (int i = 0; i < 3; i++) {
+    boundingBoxMin.x = std::max(0.f, std::min(boundingBoxMin.x, pts[i].x));
+    boundingBoxMin.y = std::max(0.f, std::min(boundingBoxMin.y, pts[i].y));
+
+    boundingBoxMax.x =
+        std::min(imageBoundary.x, std::max(boundingBoxMax.x, pts[i].x));
+    boundingBoxMax.y =
+        std::min(imageBoundary.y, std::max(boundingBoxMax.y, pts[i].y));
+  }
+
+  // Skip ahead to the clip window in whole pixel steps so the sample
+  // positions stay the same as when walking the full bounding box.
+  Vec2f start = boundingBoxMin;
+  if (start.x < target.x0)
+    start.x += std::ceil(target.x0 - start.x);
+  if (start.y < target.y0)
+    start.y += std::ceil(target.y0 - start.y);
+
+  int written = 0, tested = 0;
+  Vec3f iter;
+  for (iter.x = start.x; iter.x < boundingBoxMax.x && iter.x < target.x1;
+       iter.x++) {
+    for (iter.y = start.y; iter.y < boundingBoxMax.y && iter.y < target.y1;
+         iter.y++) {
+      Vec3f barycentricP = barycentric(pts, iter);
+      if (barycentricP.x < 0 || barycentricP.y < 0 || barycentricP.z < 0)
+        continue;
+      iter.z = 0;
+      for (int i = 0; i < 3; i++) {
+        iter.z += pts[i].z * barycentricP.z;
+      }
+      tested++;
+      float &depth = target.zbuffer[(int(iter.x) - target.x0) +
+                                    (int(iter.y) - target.y0) * target.zstride];
+      if (depth < iter.z) {
+        depth = iter.z;
+        fb.set(int(iter.x), int(iter.y), pixel);
+        written++;
+      }
+    }
+  }
+  STAT_ADD(STAT_PIXELS_TESTED, tested);
+  return written;
+}
+
+} // namespace
+
+int triangle2(const RasterTarget &target, const TGAColor &color,
+              const Vec3f *pts) {
+  return with_framebuffer(*target.image, [&](const auto &fb) {
+    return barycentric_fill(target, fb, color, pts);
+  });
+}
+int draw_triangle(const RasterTarget &target, const TGAColor &color,
+                  const Vec3f *pts, Rasterizer rasterizer) {
+  if (target.hiz)
+    return triangle_hiz(target, color, pts, rasterizer);
+  if (rasterizer == EDGE)
+    return triangle_edge(target, color, pts);
+  return triangle2(target, color, pts);
+}
+
+int draw_triangle(const RasterTarget &target, const TGAColor &color,
+                  const Vec3f *pts, const RenderOptions &opts) {
+  return draw_triangle(target, color, pts, opts.rasterizer);
+}
+
+void sort_front_to_back(int *order, int n, const ScreenTriangle *tris) {
+  auto key = [tris](int i) {
+    return tris[i].pts[0].z + tris[i].pts[1].z + tris[i].pts[2].z;
+  };
+  std::stable_sort(order, order + n,
+                   [&key](int a, int b) { return key(a) > key(b); });
+}
+
+Vec3f world2screen(Vec3f v, int width, int height) {
+  return Vec3f(int((v.x + 1.) * width / 2. + .5),
+               int((v.y + 1.) * height / 2. + .5), v.z);
+}
+
+bool face_setup(const Model *model, const VertexBuffer &vertices, int i,
+                Vec3f *screen, TGAColor &color, const RenderOptions &opts) {
+  Face face = model->face(i);
+
+  for (int j = 0; j < 3; j++)
+    screen[j] = vertices.screen[face[j]];
+  if (opts.cull_backfaces && backfacing(screen))
+    return false;
+
+  float intensity = face_intensity(vertices, i, opts.light_dir);
+  if (intensity > 0) {
+    color = TGAColor(intensity * 255, intensity * 255, intensity * 255, 255);
+    return true;
+  }
+  return false;
+}
+
+void mesh(const Model *model, const TGAColor &color, TGAImage &image,
+          const RenderOptions &opts) {
+  RenderContext context;
+  mesh(model, color, image, opts, context);
+}
+
+void mesh(const Model *model, const TGAColor &color, TGAImage &image,
+          const RenderOptions &opts, RenderContext &context) {
+  if (opts.samples > 1) {
+    FlatShader shader{opts.light_dir};
+    mesh_shaded(model, shader, image, opts, context);
+    return;
+  }
+  if (opts.threads != 1 || image.is_tiled()) {
+    mesh_tiled(model, image, opts, context);
+    return;
+  }
+  context.arena.reset();
+
+  int width = image.get_width(), height = image.get_height();
+  STAT_ADD(STAT_FRAMES, 1);
+  STAT_ADD(STAT_FACES_SUBMITTED, model->nfaces());
+  Visibility visibility =
+      mesh_visibility(model, width, height, opts.transform);
+  if (visibility == OUTSIDE) {
+    STAT_ADD(STAT_FACES_CULLED, model->nfaces());
+    return;
+  }
+
+  context.zbuffer.assign(width * height, -std::numeric_limits<float>::max());
+  float *zbuffer = context.zbuffer.data();
+
+  VertexBuffer &vertices = context.vertices;
+  process_vertices(model, width, height, vertices, 1, opts.transform);
+
+  RasterTarget target{&image, zbuffer, width, 0, 0, width, height};
+  if (opts.hiz) {
+    HiZBuffer &hiz = context.keep<HiZBuffer>();
+    hiz.reset(0, 0, width, height);
+    target.hiz = &hiz;
+  }
+
+  // Every face is set up before the first is drawn, which the sort needs
+  // anyway and which lets each stage be timed once rather than per face.
+  int nFaces = model->nfaces();
+  ScreenTriangle clipped[5];
+  int culled = 0, written = 0;
+  STAT_WATCH(watch);
+  std::vector<ScreenTriangle> &tris = context.tris;
+  tris.clear();
+  for (int i = 0; i < nFaces; i++) {
+    int n = setup_face(model, vertices, i, visibility, width, height, opts,
+                       clipped);
+    culled += n == 0;
+    tris.insert(tris.end(), clipped, clipped + n);
+  }
+  const int count = (int)tris.size();
+  int *order = nullptr;
+  if (opts.sort_faces) {
+    order = context.arena.alloc<int>(count);
+    for (int i = 0; i < count; i++)
+      order[i] = i;
+    sort_front_to_back(order, count, tris.data());
+  }
+  STAT_LAP(watch, STAGE_SETUP);
+  for (int k = 0; k < count; k++) {
+    const ScreenTriangle &tri = tris[order ? order[k] : k];
+    written += draw_triangle(target, tri.color, tri.pts, opts);
+  }
+  STAT_LAP(watch, STAGE_RASTER);
+  STAT_ADD(STAT_FACES_CULLED, culled);
+  STAT_ADD(STAT_TRIANGLES_RASTERIZED, count);
+  STAT_ADD(STAT_PIXELS_WRITTEN, written);
+}
+void rasterize(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color,
+               int ybuffer[]) {
+  if (p0.x > p1.x) {
+    std::swap(p0, p1);
+  }
+  for (int x = p0.x; x <= p1.x; x++) {
+    float t = (x - p0.x) / (float)(p1.x - p0.x);
+    int y = p0.y * (1. - t) + p1.y * t;
+    if (ybuffer[x] < y) {
+      ybuffer[x] = y;
+      image.set(x, 0, color);
+    }
+  }
+}
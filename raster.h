@@ -0,0 +1,166 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include "arena.h"
+#include "geometry.h"
+#include "model.h"
+#include "tgaimage.h"
+#include "vertex.h"
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+class HiZBuffer;
+class MultisampleBuffer;
+
+// Per pixel coverage test used for filled triangles.
+enum Rasterizer {
+  BARYCENTRIC = 0, // triangle2(), barycentric() at every pixel
+  EDGE = 1,        // triangle_edge(), stepped edge functions in SIMD blocks
+};
+
+// Knobs for mesh(). The defaults reproduce the original single threaded path.
+struct RenderOptions {
+  // worker threads, 1 renders serially, 0 uses every hardware thread
+  int threads = 1;
+  // edge length in pixels of the screen tiles the threaded path bins into
+  int tile_size = 64;
+  // both rasterizers produce the same pixels, EDGE is just faster
+  Rasterizer rasterizer = EDGE;
+  // keep a hierarchical depth buffer and skip triangles and 8x8 blocks it
+  // proves hidden, same pixels as without
+  bool hiz = false;
+  // draw faces roughly nearest first so hidden ones get rejected early,
+  // equal depths may then resolve to a different face
+  bool sort_faces = false;
+  // drop faces wound clockwise on screen before lighting them, which also
+  // drops a few slivers the light test alone would keep
+  bool cull_backfaces = false;
+  // samples per pixel, 2, 4 or 8 anti-alias through a MultisampleBuffer,
+  // which mesh() draws with FlatShader; see msaa.h
+  int samples = 1;
+  // where the model is put before projection, see vertex.h
+  ModelTransform transform;
+  // direction the light travels, faces lit by it are shaded by the cosine
+  Vec3f light_dir = Vec3f(0, 0, -1);
+};
+
+// A window of the screen plus the depth values backing it. For the plain
+// full screen case the window is the whole image and zbuffer is the usual
+// width*height array; a screen tile instead carries only its own slice, with
+// zbuffer pointing at the depth of pixel (x0, y0).
+struct RasterTarget {
+  TGAImage *image;
+  float *zbuffer;
+  int zstride;
+  int x0, y0, x1, y1; // half-open clip rectangle in screen pixels
+  // optional coarse depth over the same window, see hiz.h
+  HiZBuffer *hiz = nullptr;
+  // samples standing in for the image and the z-buffer, see msaa.h; with
+  // them zbuffer is left null
+  MultisampleBuffer *msaa = nullptr;
+};
+
+// A face after setup: screen space corners and its flat color.
+struct ScreenTriangle {
+  Vec3f pts[3];
+  TGAColor color;
+};
+
+void swapInt(int *a, int *b);
+
+void line(TGAImage &image, const TGAColor &color, int x1, int y1, int x2,
+          int y2);
+// fill_triangle() with whole pixel corners.
+void triangle(TGAImage &image, const TGAColor &color, int x0, int y0, int x1,
+              int y1, int x2, int y2);
+// Flat filled triangle without depth, for 2D overlays: corners in pixel
+// units with 1/16 pixel precision, pixels whose centers are inside under the
+// top-left fill rule, each row written as one span. See scanline.cpp.
+void fill_triangle(TGAImage &image, const TGAColor &color, const Vec2f *pts);
+Vec3f barycentric(const Vec3f *pts, const Vec3f P);
+void triangle2(TGAImage &image, float *zbuffer, const TGAColor &color,
+               const Vec3f *pts);
+// Clipped to the target window, returns the number of pixels written.
+int triangle2(const RasterTarget &target, const TGAColor &color,
+              const Vec3f *pts);
+// Drop-in replacement for triangle2() that steps edge functions incrementally
+// in row order, several pixels per instruction. Writes exactly the pixels and
+// depths triangle2() would, falling back to it for triangles with non integer
+// or very large screen coordinates.
+void triangle_edge(TGAImage &image, float *zbuffer, const TGAColor &color,
+                   const Vec3f *pts);
+int triangle_edge(const RasterTarget &target, const TGAColor &color,
+                  const Vec3f *pts);
+// Draws a filled triangle with the rasterizer selected in opts, through the
+// target's hierarchical depth buffer when it has one.
+int draw_triangle(const RasterTarget &target, const TGAColor &color,
+                  const Vec3f *pts, const RenderOptions &opts);
+int draw_triangle(const RasterTarget &target, const TGAColor &color,
+                  const Vec3f *pts, Rasterizer rasterizer);
+
+// Reorders triangle indices nearest first (larger z wins the depth test).
+// Only a heuristic for occlusion culling, ties keep their order.
+void sort_front_to_back(int *order, int n, const ScreenTriangle *tris);
+void rasterize(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color,
+               int ybuffer[]);
+
+Vec3f world2screen(Vec3f v, int width, int height);
+
+// The direction the camera looks in, in the space the vertex stage leaves
+// positions and normals in: world2screen() drops z and larger z is nearer, so
+// a face turned toward the viewer has a normal with a positive component
+// along it.
+inline Vec3f view_direction() { return Vec3f(0, 0, -1); }
+
+// Cosine between face i's normal and light_dir, the face's Lambert term.
+inline float face_intensity(const VertexBuffer &vertices, int i,
+                            const Vec3f &light_dir) {
+  return vertices.face_normals[i] * light_dir;
+}
+
+// Assembles and lights face i from the vertex stage output, filling its
+// screen coordinates and flat color. Returns false when the face is culled
+// as backfacing or points away from the light, and is not drawn at all.
+bool face_setup(const Model *model, const VertexBuffer &vertices, int i,
+                Vec3f *screen, TGAColor &color, const RenderOptions &opts);
+
+// Everything a frame of mesh() and the other draw calls needs besides the
+// model and the image. Callers rendering many frames keep one around, so
+// after the first frame or two nothing is allocated any more.
+class RenderContext {
+public:
+  std::vector<float> zbuffer;
+  VertexBuffer vertices;
+  std::vector<ScreenTriangle> tris; // faces set up, awaiting rasterization
+
+  // Transient arrays of one draw call, reset as the next one begins.
+  FrameArena arena;
+
+  // Buffers a draw path keeps from frame to frame, one object of each type,
+  // default constructed on first use. Lets the threaded paths hold on to
+  // their bins and per worker state without the context knowing their types.
+  template <class T> T &keep() {
+    for (const Kept &kept : kept_)
+      if (kept.type == typeid(T))
+        return *static_cast<T *>(kept.object.get());
+    std::shared_ptr<T> object = std::make_shared<T>();
+    kept_.push_back({typeid(T), object});
+    return *object;
+  }
+
+private:
+  struct Kept {
+    std::type_index type;
+    std::shared_ptr<void> object;
+  };
+  std::vector<Kept> kept_;
+};
+
+void mesh(const Model *model, const TGAColor &color, TGAImage &image,
+          const RenderOptions &opts = RenderOptions());
+void mesh(const Model *model, const TGAColor &color, TGAImage &image,
+          const RenderOptions &opts, RenderContext &context);
+
+#endif //__RASTER_H__
@@ -0,0 +1,251 @@
+#include "raster.h"
+#include "framebuffer.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Incremental edge function rasterizer.
+//
+// triangle2() asks barycentric() about every pixel of the bounding box, which
+// costs a cross product and three divisions each. For the triangles mesh()
+// produces (integer x/y after world2screen) those edge functions are exact
+// integers and only change by a constant from one pixel to the next, so here
+// they are stepped along each row instead and tested 8 (AVX2, built with
+// make SIMD=avx2) or 4 (SSE2) pixels at a time. Depth still goes through the
+// same float expression as triangle2(), on the same operands, so both paths
+// write identical pixels.
+//
+// With integer coordinates barycentric() computes
+//   ux = (x1-x0)(y0-py) + (px-x0)(y1-y0)
+//   uy = (x0-px)(y2-y0) + (x2-x0)(py-y0)
+//   uz = (x2-x0)(y1-y0) - (x1-x0)(y2-y0)
+// exactly as long as no term reaches 2^24, and a pixel is inside when after
+// flipping all signs so that uz > 0, ux >= 0, uy >= 0 and ux + uy <= uz.
+
+namespace {
+
+// Largest bounding box edge for which every edge function term, and the sums
+// of them, still fit a float mantissa exactly. Bigger (or non integer)
+// triangles take the barycentric path.
+const float max_extent = 2047;
+// Keeps the float to int conversions of the corners well defined.
+const float max_coord = 1 << 24;
+
+inline bool integral(float v) { return v == std::floor(v); }
+
+struct Edges {
+  int ux, uy;   // edge functions at the first pixel of the row
+  int dux, duy; // step one pixel right
+  int dvx, dvy; // step one row down
+  int uz;       // twice the signed area, positive
+  float uzf;    // uz before the sign flip, as barycentric() divides by it
+};
+
+template <class FB>
+inline int shade(const FB &fb, typename FB::Pixel color, const Vec3f *pts,
+                 float uzf, int ux, float *depth, int x, int y) {
+  float w = float(ux) / uzf;
+  float z = 0;
+  for (int i = 0; i < 3; i++) {
+    z += pts[i].z * w;
+  }
+  if (*depth < z) {
+    *depth = z;
+    fb.set(x, y, color);
+    return 1;
+  }
+  return 0;
+}
+
+template <class FB>
+int edge_fill(const RasterTarget &target, const FB &fb, const TGAColor &color,
+              const Vec3f *pts) {
+  float minX = std::numeric_limits<float>::max(), maxX = -minX;
+  float minY = minX, maxY = maxX;
+  bool exact = true;
+  for (int i = 0; i < 3; i++) {
+    minX = std::min(minX, pts[i].x);
+    maxX = std::max(maxX, pts[i].x);
+    minY = std::min(minY, pts[i].y);
+    maxY = std::max(maxY, pts[i].y);
+    exact = exact && integral(pts[i].x) && integral(pts[i].y) &&
+            std::abs(pts[i].x) < max_coord && std::abs(pts[i].y) < max_coord;
+  }
+  if (!exact || maxX - minX > max_extent || maxY - minY > max_extent) {
+    return triangle2(target, color, pts);
+  }
+
+  // The pixel window triangle2() walks, as integers.
+  int sx = std::max({0, int(minX), target.x0});
+  int sy = std::max({0, int(minY), target.y0});
+  int ex = std::min({int(maxX), fb.width() - 1, target.x1});
+  int ey = std::min({int(maxY), fb.height() - 1, target.y1});
+  if (sx >= ex || sy >= ey)
+    return 0;
+
+  const int x0 = pts[0].x, y0 = pts[0].y;
+  const int x1 = pts[1].x, y1 = pts[1].y;
+  const int x2 = pts[2].x, y2 = pts[2].y;
+
+  Edges e;
+  e.uz = (x2 - x0) * (y1 - y0) - (x1 - x0) * (y2 - y0);
+  if (e.uz == 0)
+    return 0; // barycentric() rejects |uz| < 1
+  e.uzf = float(e.uz);
+  e.ux = (x1 - x0) * (y0 - sy) + (sx - x0) * (y1 - y0);
+  e.uy = (x0 - sx) * (y2 - y0) + (x2 - x0) * (sy - y0);
+  e.dux = y1 - y0;
+  e.duy = -(y2 - y0);
+  e.dvx = -(x1 - x0);
+  e.dvy = x2 - x0;
+  if (e.uz < 0) {
+    e.uz = -e.uz;
+    e.ux = -e.ux, e.uy = -e.uy;
+    e.dux = -e.dux, e.duy = -e.duy;
+    e.dvx = -e.dvx, e.dvy = -e.dvy;
+  }
+  // Depth wants ux with the sign barycentric() sees.
+  const int sign = e.uzf < 0 ? -1 : 1;
+  const typename FB::Pixel pixel = FB::pack(color);
+
+#if defined(__AVX2__)
+  const int lanes = 8;
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i vdux = _mm256_mullo_epi32(_mm256_set1_epi32(e.dux), lane);
+  const __m256i vduy = _mm256_mullo_epi32(_mm256_set1_epi32(e.duy), lane);
+  const __m256i stepx = _mm256_set1_epi32(lanes * e.dux);
+  const __m256i stepy = _mm256_set1_epi32(lanes * e.duy);
+  const __m256i vuz = _mm256_set1_epi32(e.uz);
+  const __m256i minus1 = _mm256_set1_epi32(-1);
+  const __m256i vsign = _mm256_set1_epi32(sign);
+  const __m256 uzf = _mm256_set1_ps(e.uzf);
+  const __m256 z0 = _mm256_set1_ps(pts[0].z);
+  const __m256 z1 = _mm256_set1_ps(pts[1].z);
+  const __m256 z2 = _mm256_set1_ps(pts[2].z);
+#elif defined(__SSE2__)
+  const int lanes = 4;
+  const __m128i vdux = _mm_setr_epi32(0, e.dux, 2 * e.dux, 3 * e.dux);
+  const __m128i vduy = _mm_setr_epi32(0, e.duy, 2 * e.duy, 3 * e.duy);
+  const __m128i stepx = _mm_set1_epi32(lanes * e.dux);
+  const __m128i stepy = _mm_set1_epi32(lanes * e.duy);
+  const __m128i vuz = _mm_set1_epi32(e.uz);
+  const __m128i minus1 = _mm_set1_epi32(-1);
+  const __m128 uzf = _mm_set1_ps(e.uzf);
+  const __m128 z0 = _mm_set1_ps(pts[0].z);
+  const __m128 z1 = _mm_set1_ps(pts[1].z);
+  const __m128 z2 = _mm_set1_ps(pts[2].z);
+#else
+  const int lanes = 1;
+#endif
+
+  int written = 0, tested = 0;
+  for (int y = sy; y < ey; y++) {
+    float *depth = target.zbuffer + (y - target.y0) * target.zstride +
+                   (sx - target.x0);
+    int x = sx;
+    int ux = e.ux, uy = e.uy;
+
+#if defined(__AVX2__)
+    __m256i vux = _mm256_add_epi32(_mm256_set1_epi32(ux), vdux);
+    __m256i vuy = _mm256_add_epi32(_mm256_set1_epi32(uy), vduy);
+    for (; x + lanes <= ex; x += lanes, depth += lanes) {
+      __m256i in = _mm256_and_si256(_mm256_cmpgt_epi32(vux, minus1),
+                                    _mm256_cmpgt_epi32(vuy, minus1));
+      in = _mm256_andnot_si256(
+          _mm256_cmpgt_epi32(_mm256_add_epi32(vux, vuy), vuz), in);
+      int mask = _mm256_movemask_ps(_mm256_castsi256_ps(in));
+      if (mask) {
+        tested += __builtin_popcount(mask);
+        __m256 w = _mm256_div_ps(
+            _mm256_cvtepi32_ps(_mm256_mullo_epi32(vux, vsign)), uzf);
+        __m256 z = _mm256_add_ps(_mm256_setzero_ps(), _mm256_mul_ps(z0, w));
+        z = _mm256_add_ps(z, _mm256_mul_ps(z1, w));
+        z = _mm256_add_ps(z, _mm256_mul_ps(z2, w));
+        __m256 zb = _mm256_loadu_ps(depth);
+        __m256 pass = _mm256_and_ps(_mm256_cmp_ps(zb, z, _CMP_LT_OQ),
+                                    _mm256_castsi256_ps(in));
+        mask = _mm256_movemask_ps(pass);
+        if (mask) {
+          _mm256_storeu_ps(depth, _mm256_blendv_ps(zb, z, pass));
+          fb.set_mask(x, y, mask, pixel);
+          written += __builtin_popcount(mask);
+        }
+      }
+      vux = _mm256_add_epi32(vux, stepx);
+      vuy = _mm256_add_epi32(vuy, stepy);
+    }
+    ux += (x - sx) * e.dux;
+    uy += (x - sx) * e.duy;
+#elif defined(__SSE2__)
+    __m128i vux = _mm_add_epi32(_mm_set1_epi32(ux), vdux);
+    __m128i vuy = _mm_add_epi32(_mm_set1_epi32(uy), vduy);
+    for (; x + lanes <= ex; x += lanes, depth += lanes) {
+      __m128i in = _mm_and_si128(_mm_cmpgt_epi32(vux, minus1),
+                                 _mm_cmpgt_epi32(vuy, minus1));
+      in = _mm_andnot_si128(_mm_cmpgt_epi32(_mm_add_epi32(vux, vuy), vuz), in);
+      int mask = _mm_movemask_ps(_mm_castsi128_ps(in));
+      if (mask) {
+        tested += __builtin_popcount(mask);
+        // SSE2 has no 32 bit multiply, so undo the sign flip on the floats.
+        __m128 w = _mm_cvtepi32_ps(vux);
+        if (sign < 0)
+          w = _mm_sub_ps(_mm_setzero_ps(), w);
+        w = _mm_div_ps(w, uzf);
+        __m128 z = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(z0, w));
+        z = _mm_add_ps(z, _mm_mul_ps(z1, w));
+        z = _mm_add_ps(z, _mm_mul_ps(z2, w));
+        __m128 zb = _mm_loadu_ps(depth);
+        __m128 pass = _mm_and_ps(_mm_cmplt_ps(zb, z), _mm_castsi128_ps(in));
+        mask = _mm_movemask_ps(pass);
+        if (mask) {
+          _mm_storeu_ps(depth, _mm_or_ps(_mm_and_ps(pass, z),
+                                         _mm_andnot_ps(pass, zb)));
+          fb.set_mask(x, y, mask, pixel);
+          written += __builtin_popcount(mask);
+        }
+      }
+      vux = _mm_add_epi32(vux, stepx);
+      vuy = _mm_add_epi32(vuy, stepy);
+    }
+    ux += (x - sx) * e.dux;
+    uy += (x - sx) * e.duy;
+#endif
+
+    // Row remainder, or the whole row without SIMD.
+    for (; x < ex; x++, depth++, ux += e.dux, uy += e.duy) {
+      if (ux >= 0 && uy >= 0 && ux + uy <= e.uz) {
+        tested++;
+        written += shade(fb, pixel, pts, e.uzf, sign * ux, depth, x, y);
+      }
+    }
+
+    e.ux += e.dvx;
+    e.uy += e.dvy;
+  }
+  (void)lanes;
+  STAT_ADD(STAT_PIXELS_TESTED, tested);
+  return written;
+}
+
+} // namespace
+
+void triangle_edge(TGAImage &image, float *zbuffer, const TGAColor &color,
+                   const Vec3f *pts) {
+  RasterTarget target{&image,           zbuffer, image.get_width(), 0, 0,
+                      image.get_width(), image.get_height()};
+  triangle_edge(target, color, pts);
+}
+
+int triangle_edge(const RasterTarget &target, const TGAColor &color,
+                  const Vec3f *pts) {
+  return with_framebuffer(*target.image, [&](const auto &fb) {
+    return edge_fill(target, fb, color, pts);
+  });
+}
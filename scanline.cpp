@@ -0,0 +1,134 @@
+#include "framebuffer.h"
+#include "raster.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Scanline triangle fill for flat 2D layers.
+//
+// Corners are snapped to 28.4 fixed point (1/16 pixel). A pixel is covered
+// when its center, (x + .5, y + .5), lies inside the triangle, with the
+// top-left rule deciding centers exactly on an edge: left and top edges are
+// in, right and bottom edges out. Triangles sharing an edge therefore never
+// both cover a pixel on it, nor leave a gap.
+//
+// Each edge is stepped one row at a time as an exact rational: the first
+// covered column at a row is ceil(v / d) for a numerator v that grows by a
+// constant per row, kept as a whole part plus remainder the way Bresenham
+// keeps its error term. No division happens inside the row loop, and every
+// row is written as one contiguous span.
+
+namespace {
+
+const int subpixel = 16; // 28.4
+const int half = subpixel / 2;
+// Past this many pixels from the origin the row numerators could overflow.
+const float max_coord = 1 << 20;
+
+inline int64_t floor_div(int64_t a, int64_t b) {
+  int64_t q = a / b;
+  return q - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+inline int64_t ceil_div(int64_t a, int64_t b) { return -floor_div(-a, b); }
+
+// First pixel column whose center is at or right of the edge, row by row.
+struct EdgeStep {
+  int64_t x;    // ceil(v / d) for the current row
+  int64_t r;    // x * d - v, in [0, d)
+  int64_t d;    // subpixel * dy
+  int64_t qs;   // whole columns per row
+  int64_t ss;   // remaining numerator per row, in [0, d)
+
+  // Edge from (ax, ay) to (bx, by) in fixed point, ay < by, positioned at
+  // the row whose center is yc.
+  void start(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t yc) {
+    int64_t dx = bx - ax, dy = by - ay;
+    d = subpixel * dy;
+    // Centers at or right of the edge satisfy
+    //   xc * dy >= ax * dy + (yc - ay) * dx   with xc = 16 x + 8
+    int64_t v = ax * dy + (yc - ay) * dx - half * dy;
+    x = ceil_div(v, d);
+    r = x * d - v;
+    int64_t step = subpixel * dx;
+    qs = floor_div(step, d);
+    ss = step - qs * d;
+  }
+  void next() {
+    x += qs;
+    r -= ss;
+    if (r < 0) {
+      r += d;
+      x++;
+    }
+  }
+};
+
+// First pixel row whose center is at or below y (fixed point).
+inline int64_t first_row(int64_t y) { return ceil_div(y - half, subpixel); }
+
+template <class FB>
+void fill(const FB &fb, typename FB::Pixel pixel, const int64_t *x,
+          const int64_t *y) {
+  // Sort corners top to bottom.
+  int i0 = 0, i1 = 1, i2 = 2;
+  if (y[i1] < y[i0])
+    std::swap(i0, i1);
+  if (y[i2] < y[i1])
+    std::swap(i1, i2);
+  if (y[i1] < y[i0])
+    std::swap(i0, i1);
+  const int64_t x0 = x[i0], y0 = y[i0], x1 = x[i1], y1 = y[i1], x2 = x[i2],
+                y2 = y[i2];
+
+  // Side of the long edge 0-2 the middle corner is on.
+  int64_t area = (x2 - x0) * (y1 - y0) - (x1 - x0) * (y2 - y0);
+  if (area == 0)
+    return;
+  const bool long_is_left = area < 0;
+
+  const int width = fb.width(), height = fb.height();
+  int64_t top = std::max<int64_t>(first_row(y0), 0);
+  int64_t mid = std::min<int64_t>(std::max<int64_t>(first_row(y1), top),
+                                  height);
+  int64_t bottom = std::min<int64_t>(first_row(y2), height);
+  if (top >= bottom)
+    return;
+
+  EdgeStep along, upper, lower;
+  along.start(x0, y0, x2, y2, top * subpixel + half);
+  auto spans = [&](int64_t from, int64_t to, EdgeStep &side) {
+    EdgeStep &left = long_is_left ? along : side;
+    EdgeStep &right = long_is_left ? side : along;
+    for (int64_t row = from; row < to; row++) {
+      int64_t xl = std::max<int64_t>(left.x, 0);
+      int64_t xr = std::min<int64_t>(right.x, width);
+      if (xl < xr)
+        fb.span((int)xl, (int)xr, (int)row, pixel);
+      left.next();
+      right.next();
+    }
+  };
+  if (top < mid) {
+    upper.start(x0, y0, x1, y1, top * subpixel + half);
+    spans(top, mid, upper);
+  }
+  if (mid < bottom) {
+    lower.start(x1, y1, x2, y2, mid * subpixel + half);
+    spans(mid, bottom, lower);
+  }
+}
+
+} // namespace
+
+void fill_triangle(TGAImage &image, const TGAColor &color, const Vec2f *pts) {
+  int64_t x[3], y[3];
+  for (int i = 0; i < 3; i++) {
+    if (!(std::abs(pts[i].x) < max_coord && std::abs(pts[i].y) < max_coord))
+      return;
+    x[i] = (int64_t)std::lround(pts[i].x * subpixel);
+    y[i] = (int64_t)std::lround(pts[i].y * subpixel);
+  }
+  with_framebuffer(image,
+                   [&](const auto &fb) { fill(fb, fb.pack(color), x, y); });
+}
@@ -0,0 +1,290 @@
+#include "server.h"
+#include "batch.h"
+#include "parallel.h"
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const int lod_levels = 6;
+
+// Where the answers to one stream of jobs go. Shared by its reader and every
+// job from it still in flight; a connection is closed once the last of them
+// lets go.
+class Reply {
+public:
+  Reply(int fd, bool owned) : fd_(fd), owned_(owned) {}
+  ~Reply() {
+    if (owned_)
+      close(fd_);
+  }
+  Reply(const Reply &) = delete;
+  Reply &operator=(const Reply &) = delete;
+
+  // Writes line and a newline in one piece. A peer that went away is not an
+  // error of the server's, what it misses is dropped.
+  void send(std::string line) {
+    line += '\n';
+    std::lock_guard<std::mutex> lock(mutex_);
+    const char *p = line.data();
+    size_t left = line.size();
+    while (left > 0) {
+      ssize_t n = write(fd_, p, left);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return;
+      p += n;
+      left -= n;
+    }
+  }
+
+private:
+  int fd_;
+  bool owned_;
+  std::mutex mutex_;
+};
+
+struct Job {
+  std::string line;
+  std::shared_ptr<Reply> reply;
+};
+
+// The worker pool and the model cache, alive for as long as the server is.
+class Server {
+public:
+  explicit Server(const ServerOptions &options)
+      : options_(options),
+        cache_(options.cached_models, options.render.threads,
+               options.lod_tolerance > 0) {
+    const int workers = resolve_threads(options.workers);
+    for (int i = 0; i < workers; i++)
+      workers_.emplace_back([this]() { work(); });
+  }
+  // Finishes every job queued so far.
+  ~Server() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    ready_.notify_all();
+    for (std::thread &worker : workers_)
+      worker.join();
+  }
+
+  void submit(const std::string &line, const std::shared_ptr<Reply> &reply) {
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#')
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back({line, reply});
+    }
+    ready_.notify_one();
+  }
+
+private:
+  ServerOptions options_;
+  ModelCache cache_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<Job> queue_;
+  bool closed_ = false;
+  std::vector<std::thread> workers_;
+
+  void work() {
+    TGAImage image{options_.width, options_.height, TGAImage::RGB};
+    RenderContext context;
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return closed_ || !queue_.empty(); });
+        if (queue_.empty())
+          return;
+        job = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      job.reply->send(run(job.line, image, context));
+    }
+  }
+
+  // Renders the job on line, returns its answer.
+  std::string run(const std::string &line, TGAImage &image,
+                  RenderContext &context) {
+    const TGAColor green{0, 255, 0, 255};
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    std::istringstream fields(line);
+    std::string path, output;
+    if (!(fields >> path >> output))
+      return "error - bad job";
+    RenderOptions opts = options_.render;
+    if (!(fields >> std::ws).eof() &&
+        !read_camera(fields, options_.render, opts))
+      return "error " + output + " bad camera";
+    std::shared_ptr<const CachedModel> cached = cache_.get(path);
+    if (!cached)
+      return "error " + output + " can't load " + path;
+
+    const Model *level = cached->lods.select(
+        options_.width, options_.height, opts.transform,
+        options_.lod_tolerance);
+    image.clear();
+    mesh(level, green, image, opts, context);
+    image.flip_vertically();
+    if (!image.write_tga_file(output.c_str(), true, opts.threads))
+      return "error " + output + " can't write";
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    std::ostringstream answer;
+    answer << "ok " << output << " " << ms;
+    return answer.str();
+  }
+};
+
+// Calls fn with every line read from fd until it ends, newlines stripped.
+template <class F> void read_lines(int fd, F fn) {
+  std::string pending;
+  char buffer[4096];
+  for (;;) {
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    pending.append(buffer, n);
+    size_t start = 0, end;
+    while ((end = pending.find('\n', start)) != std::string::npos) {
+      fn(pending.substr(start, end - start));
+      start = end + 1;
+    }
+    pending.erase(0, start);
+  }
+  if (!pending.empty())
+    fn(pending);
+}
+
+} // namespace
+
+CachedModel::CachedModel(const char *path, int threads, bool lods)
+    : model(path, threads),
+      lods(&model, lods ? lod_levels : 1, .5f, 64, threads) {}
+
+ModelCache::ModelCache(size_t capacity, int threads, bool lods)
+    : capacity_(std::max<size_t>(1, capacity)), threads_(threads),
+      lods_(lods) {}
+
+std::shared_ptr<const CachedModel> ModelCache::get(const std::string &path) {
+  std::promise<std::shared_ptr<const CachedModel>> promise;
+  Pending pending;
+  unsigned long serial = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, found->second);
+      pending = found->second->model;
+    } else {
+      pending = promise.get_future().share();
+      serial = ++loads_;
+      entries_.push_front({path, pending, serial});
+      index_[path] = entries_.begin();
+      while (entries_.size() > capacity_) {
+        index_.erase(entries_.back().path);
+        entries_.pop_back();
+      }
+    }
+  }
+  // Waited for and loaded outside the lock, other models stay available
+  // meanwhile.
+  if (!serial)
+    return pending.get();
+
+  std::shared_ptr<CachedModel> loaded =
+      std::make_shared<CachedModel>(path.c_str(), threads_, lods_);
+  if (loaded->model.nfaces() == 0) {
+    // Forgotten, so that a later job tries the file again.
+    loaded.reset();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found != index_.end() && found->second->serial == serial) {
+      entries_.erase(found->second);
+      index_.erase(found);
+    }
+  }
+  promise.set_value(loaded);
+  return loaded;
+}
+
+bool serve_stream(int in_fd, int out_fd, const ServerOptions &options) {
+  signal(SIGPIPE, SIG_IGN);
+  std::shared_ptr<Reply> reply = std::make_shared<Reply>(out_fd, false);
+  Server server(options);
+  read_lines(in_fd,
+             [&](const std::string &line) { server.submit(line, reply); });
+  return true;
+}
+
+bool serve_socket(const char *path, const ServerOptions &options) {
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    std::cerr << "socket path too long: " << path << "\n";
+    return false;
+  }
+  strcpy(address.sun_path, path);
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    std::cerr << "can't create socket: " << strerror(errno) << "\n";
+    return false;
+  }
+  // A socket left behind by an earlier server, but nothing else, is
+  // replaced.
+  struct stat info;
+  if (lstat(path, &info) == 0 && S_ISSOCK(info.st_mode))
+    unlink(path);
+  if (bind(listener, (const sockaddr *)&address, sizeof(address)) < 0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    std::cerr << "can't listen on " << path << ": " << strerror(errno)
+              << "\n";
+    close(listener);
+    return false;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  Server server(options);
+  std::cerr << "# listening on " << path << std::endl;
+  for (;;) {
+    int client = accept(listener, nullptr, nullptr);
+    if (client < 0) {
+      if (errno != EINTR) {
+        // out of descriptors or the like, give connections time to close
+        std::cerr << "accept: " << strerror(errno) << "\n";
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      continue;
+    }
+    std::thread([&server, client]() {
+      std::shared_ptr<Reply> reply = std::make_shared<Reply>(client, true);
+      read_lines(client, [&](const std::string &line) {
+        server.submit(line, reply);
+      });
+    }).detach();
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include "lod.h"
+#include "model.h"
+#include "raster.h"
+#include <cstddef>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// A long running renderer that takes jobs over a pipe or a Unix socket, so a
+// request costs its render and not a process start and a model parse.
+//
+// A job is one line, "model output [yaw zoom [lx ly lz]]": the obj file or
+// binary mesh to draw, the TGA file to write and the camera as in a frame
+// list (see read_camera()), all separated by whitespace. Blank lines and
+// lines starting with '#' are skipped. Every job is answered on a line of its
+// own, "ok output ms" once the file is written or "error output reason", in
+// the order jobs finish rather than the order they came in.
+//
+// Jobs run on a fixed pool of workers, each keeping its image and its
+// RenderContext from job to job, so a warm worker allocates nothing. Models
+// stay loaded in a ModelCache all workers share.
+
+struct ServerOptions {
+  int width = 800, height = 800;
+  // what every job starts from before its camera is applied
+  RenderOptions render;
+  // jobs rendered at once, 0 for one per core
+  int workers = 0;
+  // models kept loaded, the least recently used dropped first
+  size_t cached_models = 8;
+  // simplification error allowed in pixels, 0 draws every face
+  float lod_tolerance = 0;
+};
+
+// A loaded model with its levels of detail, only the model itself when built
+// without them.
+struct CachedModel {
+  CachedModel(const char *path, int threads, bool lods);
+
+  Model model;
+  LodChain lods;
+};
+
+// Models by path, the `capacity` most recently used of them kept loaded. Safe
+// to use from any number of threads: a model several of them ask for at once
+// is loaded by the first, the others wait for it. A model is kept as it was
+// first loaded, later changes to its file are not seen.
+class ModelCache {
+public:
+  ModelCache(size_t capacity, int threads = 0, bool lods = false);
+
+  // The model at path, nullptr when it can't be loaded. It stays valid while
+  // the pointer is held, also after the cache has dropped it.
+  std::shared_ptr<const CachedModel> get(const std::string &path);
+
+private:
+  typedef std::shared_future<std::shared_ptr<const CachedModel>> Pending;
+  struct Entry {
+    std::string path;
+    Pending model;
+    unsigned long serial; // tells a failed load from a later retry
+  };
+
+  size_t capacity_;
+  int threads_;
+  bool lods_;
+  unsigned long loads_ = 0;
+  std::mutex mutex_;
+  std::list<Entry> entries_; // most recently used first
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+// Runs the jobs read from in_fd, answering on out_fd, until in_fd ends and
+// every job is done. Pass 0 and 1 for stdin and stdout.
+bool serve_stream(int in_fd, int out_fd, const ServerOptions &options);
+
+// Listens on a Unix socket at path, every connection a stream of jobs
+// answered on the same connection, all of them served by one worker pool and
+// one cache. Does not return once listening; returns false when the socket
+// can't be set up.
+bool serve_socket(const char *path, const ServerOptions &options);
+
+#endif //__SERVER_H__
@@ -0,0 +1,14 @@
+#include "shader.h"
+
+void GouraudShader::begin(const Model *model, const VertexBuffer &vertices) {
+  // The cosine of every vertex, eight at a time.
+  const int n = model->nverts();
+  intensity.resize(n);
+  const Vec3x8 light(light_dir);
+  for (int v = 0; v < n; v += Vec3x8::LANES) {
+    int lanes = std::min((int)Vec3x8::LANES, n - v);
+    Float8 cosine = Vec3x8::load(&vertices.vertex_normals[v], lanes) * light;
+    for (int k = 0; k < lanes; k++)
+      intensity[v + k] = std::max(0.f, cosine[k]);
+  }
+}
@@ -0,0 +1,608 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include "cull.h"
+#include "framebuffer.h"
+#include "model.h"
+#include "msaa.h"
+#include "parallel.h"
+#include "raster.h"
+#include "stats.h"
+#include "texture.h"
+#include "tgaimage.h"
+#include "vertex.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+// Programmable shading for mesh rendering.
+//
+// A shader is any class with the members below. It is a template argument of
+// the pipeline, never a base class: every call is resolved at compile time
+// and the fragment stage is inlined into the pixel loop of its own copy of
+// the rasterizer, so a shader costs what its code costs and nothing for the
+// dispatch.
+//
+//   enum { VARYINGS = n };
+//     floats handed from the corners of a face to its pixels, interpolated
+//     linearly in screen space (the projection is orthographic)
+//   struct Uniforms { ... };
+//     whatever stays constant across one face
+//   void begin(const Model *model, const VertexBuffer &vertices);
+//     once per frame after the vertex stage, e.g. for per vertex lighting
+//   bool setup(const Model *model, const VertexBuffer &vertices, int face,
+//              Uniforms &uniforms) const;
+//     once per face, false culls it
+//   void vertex(const Model *model, const VertexBuffer &vertices, int face,
+//               int corner, float *varyings) const;
+//     once per corner (0 to 2) of a face that was not culled
+//   void gradients(const float *ddx, const float *ddy,
+//                  Uniforms &uniforms) const;
+//     once per face after its corners, with how much every varying changes
+//     from one pixel to the next along x and along y, e.g. to pick a mip level
+//   bool fragment(const Uniforms &uniforms, const float *varyings,
+//                 TGAColor &color) const;
+//     once per pixel that passes the depth test, false leaves it alone
+//
+// setup, vertex and fragment are const and may run on several threads at
+// once. Coverage and depth are those of triangle2(), so FlatShader renders
+// exactly what mesh() does.
+
+// A face after setup: screen corners, per corner varyings and the face's
+// uniforms.
+template <class Shader> struct ShadedTriangle {
+  enum { VARYINGS = Shader::VARYINGS > 0 ? Shader::VARYINGS : 1 };
+  Vec3f pts[3];
+  float varyings[3][VARYINGS];
+  typename Shader::Uniforms uniforms;
+};
+
+// Lambert shading per face, what mesh() hardcodes.
+struct FlatShader {
+  enum { VARYINGS = 0 };
+  struct Uniforms {
+    TGAColor color;
+  };
+  Vec3f light_dir;
+
+  explicit FlatShader(const Vec3f &light = Vec3f(0, 0, -1))
+      : light_dir(light) {}
+  void begin(const Model *, const VertexBuffer &) {}
+  bool setup(const Model *, const VertexBuffer &vertices, int face,
+             Uniforms &uniforms) const {
+    float intensity = face_intensity(vertices, face, light_dir);
+    if (!(intensity > 0))
+      return false;
+    uniforms.color =
+        TGAColor(intensity * 255, intensity * 255, intensity * 255, 255);
+    return true;
+  }
+  void vertex(const Model *, const VertexBuffer &, int, int, float *) const {}
+  void gradients(const float *, const float *, Uniforms &) const {}
+  bool fragment(const Uniforms &uniforms, const float *,
+                TGAColor &color) const {
+    color = uniforms.color;
+    return true;
+  }
+};
+
+// Lambert shading per vertex, interpolated across faces. Vertex normals are
+// the model's area weighted ones, as the vertex stage turned them for
+// opts.transform. Faces are culled when they look away from the viewer
+// rather than from the light.
+struct GouraudShader {
+  enum { VARYINGS = 1 };
+  struct Uniforms {};
+  Vec3f light_dir;
+  std::vector<float> intensity; // per vertex, filled by begin()
+
+  explicit GouraudShader(const Vec3f &light = Vec3f(0, 0, -1))
+      : light_dir(light) {}
+  void begin(const Model *model, const VertexBuffer &vertices);
+  bool setup(const Model *, const VertexBuffer &vertices, int face,
+             Uniforms &) const {
+    // Unlike FlatShader, a face is drawn when the viewer can see it, not
+    // when the light reaches it: its color comes from the vertex normals,
+    // which may still be lit on a face turned away from the light, so
+    // culling by light_dir would cut holes along the terminator.
+    return face_intensity(vertices, face, view_direction()) > 0;
+  }
+  void vertex(const Model *model, const VertexBuffer &, int face, int corner,
+              float *varyings) const {
+    varyings[0] = intensity[model->face(face)[corner]];
+  }
+  void gradients(const float *, const float *, Uniforms &) const {}
+  bool fragment(const Uniforms &, const float *varyings,
+                TGAColor &color) const {
+    float k = std::max(0.f, std::min(1.f, varyings[0]));
+    unsigned char i = (unsigned char)(k * 255);
+    color = TGAColor(i, i, i, 255);
+    return true;
+  }
+};
+
+// A texture modulated by flat Lambert shading. Texture coordinates are the
+// caller's when given (per face corner, indexed like Model::indices()), else
+// the model's own, else the texture is projected straight along z onto the
+// model's bounding box. Every face samples the mip level matching how fast
+// its coordinates change across the screen, bilinearly within it. Without a
+// texture faces are white.
+struct TexturedShader {
+  enum { VARYINGS = 2 };
+  struct Uniforms {
+    float intensity;
+    int level;
+  };
+  Vec3f light_dir;
+
+  explicit TexturedShader(const Texture &texture, const Vec2f *uvs = nullptr,
+                          const Vec3f &light = Vec3f(0, 0, -1))
+      : light_dir(light), texture_(&texture), uvs_(uvs) {}
+  void begin(const Model *, const VertexBuffer &) {}
+  bool setup(const Model *, const VertexBuffer &vertices, int face,
+             Uniforms &uniforms) const {
+    uniforms.intensity = face_intensity(vertices, face, light_dir);
+    uniforms.level = 0;
+    return uniforms.intensity > 0;
+  }
+  void vertex(const Model *model, const VertexBuffer &, int face, int corner,
+              float *varyings) const {
+    Vec2f uv;
+    if (uvs_) {
+      uv = uvs_[model->corner(face, corner)];
+    } else if (model->has_uvs()) {
+      uv = model->uv(face, corner);
+    } else {
+      const Vec3f &v = model->vert(model->face(face)[corner]);
+      Vec3f lo = model->bbox_min(), size = model->bbox_max() - lo;
+      uv = Vec2f(size.x > 0 ? (v.x - lo.x) / size.x : 0,
+                 size.y > 0 ? (v.y - lo.y) / size.y : 0);
+    }
+    varyings[0] = uv.x;
+    varyings[1] = uv.y;
+  }
+  void gradients(const float *ddx, const float *ddy,
+                 Uniforms &uniforms) const {
+    if (texture_->empty())
+      return;
+    const float w = texture_->width(), h = texture_->height();
+    float along_x = std::hypot(ddx[0] * w, ddx[1] * h);
+    float along_y = std::hypot(ddy[0] * w, ddy[1] * h);
+    uniforms.level = texture_->level_for(std::max(along_x, along_y));
+  }
+  bool fragment(const Uniforms &uniforms, const float *varyings,
+                TGAColor &color) const {
+    float k = uniforms.intensity;
+    if (texture_->empty()) {
+      color = TGAColor(k * 255, k * 255, k * 255, 255);
+      return true;
+    }
+    TGAColor t(texture_->bilinear(uniforms.level, varyings[0], varyings[1]),
+               4);
+    color = TGAColor(t.r * k, t.g * k, t.b * k, 255);
+    return true;
+  }
+
+private:
+  const Texture *texture_;
+  const Vec2f *uvs_;
+};
+
+namespace shading {
+
+// Pixels of a triangle in the target window, walked like triangle2() walks
+// them and depth tested with its depth expression. The edge functions are
+// exact for the integer corners mesh() produces and evaluated afresh at the
+// start of every row, so a triangle split across windows comes out the same.
+template <class Shader, class FB>
+int fill(const RasterTarget &target, const FB &fb, const Shader &shader,
+         const ShadedTriangle<Shader> &tri, int &tested) {
+  const Vec3f *pts = tri.pts;
+  float minX = std::min({pts[0].x, pts[1].x, pts[2].x});
+  float maxX = std::max({pts[0].x, pts[1].x, pts[2].x});
+  float minY = std::min({pts[0].y, pts[1].y, pts[2].y});
+  float maxY = std::max({pts[0].y, pts[1].y, pts[2].y});
+  const float limit = 1 << 24;
+  if (!(minX > -limit && maxX < limit && minY > -limit && maxY < limit))
+    return 0;
+  int sx = std::max({0, int(minX), target.x0});
+  int sy = std::max({0, int(minY), target.y0});
+  int ex = std::min({int(maxX), fb.width() - 1, target.x1});
+  int ey = std::min({int(maxY), fb.height() - 1, target.y1});
+  if (sx >= ex || sy >= ey)
+    return 0;
+
+  // e1 and e2 are twice the areas opposite corners 1 and 2, their weights
+  // once divided by the whole; signs are flipped so that inside is positive.
+  const float x0 = pts[0].x, y0 = pts[0].y;
+  const float ax = pts[1].x - x0, ay = pts[1].y - y0;
+  const float bx = pts[2].x - x0, by = pts[2].y - y0;
+  float area = ax * by - bx * ay;
+  if (std::abs(area) < 1)
+    return 0; // barycentric() rejects these
+  const float sign = area < 0 ? -1.f : 1.f;
+  area *= sign;
+  const float de1 = sign * by, de2 = -sign * ay;
+  const float inv_area = 1 / area;
+
+  const int n = Shader::VARYINGS;
+  enum { SLOTS = ShadedTriangle<Shader>::VARYINGS };
+  float base[SLOTS], d1[SLOTS], d2[SLOTS];
+  for (int k = 0; k < n; k++) {
+    base[k] = tri.varyings[0][k];
+    d1[k] = tri.varyings[1][k] - base[k];
+    d2[k] = tri.varyings[2][k] - base[k];
+  }
+
+  int written = 0;
+  float varyings[SLOTS];
+  TGAColor color;
+  for (int y = sy; y < ey; y++) {
+    float *depth = target.zbuffer + (y - target.y0) * target.zstride +
+                   (sx - target.x0);
+    float e1 = sign * ((sx - x0) * by - (y - y0) * bx);
+    float e2 = sign * (ax * (y - y0) - ay * (sx - x0));
+    for (int x = sx; x < ex; x++, depth++, e1 += de1, e2 += de2) {
+      if (e1 < 0 || e2 < 0 || e1 + e2 > area)
+        continue;
+      tested++;
+      float w = e2 / area;
+      float z = 0;
+      for (int i = 0; i < 3; i++)
+        z += pts[i].z * w;
+      if (!(*depth < z))
+        continue;
+      float w1 = e1 * inv_area, w2 = e2 * inv_area;
+      for (int k = 0; k < n; k++)
+        varyings[k] = base[k] + w1 * d1[k] + w2 * d2[k];
+      if (!shader.fragment(tri.uniforms, varyings, color))
+        continue;
+      *depth = z;
+      fb.set(x, y, FB::pack(color));
+      written++;
+    }
+  }
+  return written;
+}
+
+// fill() into the target's multisample buffer. Coverage and depth are tested
+// at every sample, the fragment runs once for a pixel any of whose samples
+// passed, with the varyings at the pixel's center, and its color goes to all
+// of those samples. Pixels reach half a pixel further than fill()'s, as far
+// as a sample of theirs might be covered.
+template <int N, class Shader>
+int fill_samples(const RasterTarget &target, const Shader &shader,
+                 const ShadedTriangle<Shader> &tri, int &tested) {
+  MultisampleBuffer &msaa = *target.msaa;
+  const Vec3f *pts = tri.pts;
+  float minX = std::min({pts[0].x, pts[1].x, pts[2].x});
+  float maxX = std::max({pts[0].x, pts[1].x, pts[2].x});
+  float minY = std::min({pts[0].y, pts[1].y, pts[2].y});
+  float maxY = std::max({pts[0].y, pts[1].y, pts[2].y});
+  const float limit = 1 << 24;
+  if (!(minX > -limit && maxX < limit && minY > -limit && maxY < limit))
+    return 0;
+  int sx = std::max({0, int(std::floor(minX - .5f)) + 1, target.x0});
+  int sy = std::max({0, int(std::floor(minY - .5f)) + 1, target.y0});
+  int ex = std::min({int(std::ceil(maxX + .5f)), msaa.width(), target.x1});
+  int ey = std::min({int(std::ceil(maxY + .5f)), msaa.height(), target.y1});
+  if (sx >= ex || sy >= ey)
+    return 0;
+
+  const float x0 = pts[0].x, y0 = pts[0].y;
+  const float ax = pts[1].x - x0, ay = pts[1].y - y0;
+  const float bx = pts[2].x - x0, by = pts[2].y - y0;
+  float area = ax * by - bx * ay;
+  if (std::abs(area) < 1)
+    return 0;
+  const float sign = area < 0 ? -1.f : 1.f;
+  area *= sign;
+  const float de1 = sign * by, de2 = -sign * ay;
+  const float inv_area = 1 / area;
+  const SampleTriangle<N> samples(de1, -sign * bx, de2, sign * ax, area,
+                                  (pts[0].z + pts[1].z + pts[2].z) / area);
+
+  const int n = Shader::VARYINGS;
+  enum { SLOTS = ShadedTriangle<Shader>::VARYINGS };
+  float base[SLOTS], d1[SLOTS], d2[SLOTS];
+  for (int k = 0; k < n; k++) {
+    base[k] = tri.varyings[0][k];
+    d1[k] = tri.varyings[1][k] - base[k];
+    d2[k] = tri.varyings[2][k] - base[k];
+  }
+
+  int written = 0;
+  float varyings[SLOTS];
+  TGAColor color;
+  for (int y = sy; y < ey; y++) {
+    int begin = sx, end = ex;
+    samples.span(sign * ((sx - x0) * by - (y - y0) * bx),
+                 sign * (ax * (y - y0) - ay * (sx - x0)), begin, end);
+    if (begin >= end)
+      continue;
+    unsigned char *held = msaa.mask(begin, y);
+    float *depth = msaa.depth(begin, y);
+    uint32_t *colors = msaa.color(begin, y);
+    float e1 = sign * ((begin - x0) * by - (y - y0) * bx);
+    float e2 = sign * (ax * (y - y0) - ay * (begin - x0));
+    for (int x = begin; x < end; x++, e1 += de1, e2 += de2, held++,
+             depth += N, colors += N) {
+      unsigned pass = samples.test(e1, e2, *held, depth);
+      if (!pass)
+        continue;
+      tested++;
+      float w1 = e1 * inv_area, w2 = e2 * inv_area;
+      for (int k = 0; k < n; k++)
+        varyings[k] = base[k] + w1 * d1[k] + w2 * d2[k];
+      if (!shader.fragment(tri.uniforms, varyings, color))
+        continue;
+      samples.write(pass, e2, depth, colors, color.val);
+      *held |= pass;
+      written++;
+    }
+  }
+  return written;
+}
+
+// Runs the shader's face and corner stages for face i and clips the result
+// like setup_face() does. Corners the clipper moves get varyings interpolated
+// from the original three. Returns how many triangles went to out.
+template <class Shader>
+int setup(const Model *model, const VertexBuffer &vertices,
+          const Shader &shader, int i, Visibility visibility, int width,
+          int height, const RenderOptions &opts,
+          ShadedTriangle<Shader> *out) {
+  Face face = model->face(i);
+  ShadedTriangle<Shader> tri;
+  for (int j = 0; j < 3; j++)
+    tri.pts[j] = vertices.screen[face[j]];
+  if (opts.cull_backfaces && backfacing(tri.pts))
+    return 0;
+  if (!shader.setup(model, vertices, i, tri.uniforms))
+    return 0;
+  for (int j = 0; j < 3; j++)
+    shader.vertex(model, vertices, i, j, tri.varyings[j]);
+  {
+    // Varyings are a plane over the screen, its slopes follow from the
+    // corners.
+    const Vec3f *p = tri.pts;
+    const float ax = p[1].x - p[0].x, ay = p[1].y - p[0].y;
+    const float bx = p[2].x - p[0].x, by = p[2].y - p[0].y;
+    const float area = ax * by - bx * ay;
+    float ddx[ShadedTriangle<Shader>::VARYINGS] = {};
+    float ddy[ShadedTriangle<Shader>::VARYINGS] = {};
+    for (int k = 0; k < Shader::VARYINGS && area != 0; k++) {
+      float d1 = tri.varyings[1][k] - tri.varyings[0][k];
+      float d2 = tri.varyings[2][k] - tri.varyings[0][k];
+      ddx[k] = (d1 * by - d2 * ay) / area;
+      ddy[k] = (d2 * ax - d1 * bx) / area;
+    }
+    shader.gradients(ddx, ddy, tri.uniforms);
+  }
+  if (visibility == INSIDE) {
+    out[0] = tri;
+    return 1;
+  }
+
+  ScreenTriangle screen, clipped[5];
+  std::copy(tri.pts, tri.pts + 3, screen.pts);
+  int count = clip_triangle(screen, width, height, clipped, opts.samples);
+  const Vec3f *p = tri.pts;
+  float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) -
+               (p[2].x - p[0].x) * (p[1].y - p[0].y);
+  for (int c = 0; c < count; c++) {
+    out[c].uniforms = tri.uniforms;
+    for (int j = 0; j < 3; j++) {
+      const Vec3f &q = out[c].pts[j] = clipped[c].pts[j];
+      float w1 = 0, w2 = 0;
+      if (area != 0) {
+        w1 = ((q.x - p[0].x) * (p[2].y - p[0].y) -
+              (q.y - p[0].y) * (p[2].x - p[0].x)) / area;
+        w2 = ((p[1].x - p[0].x) * (q.y - p[0].y) -
+              (p[1].y - p[0].y) * (q.x - p[0].x)) / area;
+      }
+      for (int k = 0; k < Shader::VARYINGS; k++) {
+        const float v0 = tri.varyings[0][k];
+        out[c].varyings[j][k] = v0 + w1 * (tri.varyings[1][k] - v0) +
+                                w2 * (tri.varyings[2][k] - v0);
+      }
+      for (int o = 0; o < 3; o++)
+        if (q.x == p[o].x && q.y == p[o].y && q.z == p[o].z)
+          std::copy(tri.varyings[o], tri.varyings[o] + Shader::VARYINGS,
+                    out[c].varyings[j]);
+    }
+  }
+  return count;
+}
+
+// The faces of one run of the model after setup, binned into the screen
+// bands they reach, indices into tris in face order.
+template <class Shader> struct Chunk {
+  std::vector<ShadedTriangle<Shader>> tris;
+  std::vector<std::vector<int>> bins;
+};
+
+// Faces per setup chunk, as in the tiled mesh path.
+const int faces_per_chunk = 1024;
+
+} // namespace shading
+
+// Draws one shaded triangle into the target window, or into its multisample
+// buffer when it has one, returns the number of pixels written.
+template <class Shader>
+int shade_triangle(const RasterTarget &target, const Shader &shader,
+                   const ShadedTriangle<Shader> &tri) {
+  int tested = 0;
+  if (target.msaa) {
+    int samples = target.msaa->samples();
+    int written =
+        samples == 2   ? shading::fill_samples<2>(target, shader, tri, tested)
+        : samples == 4 ? shading::fill_samples<4>(target, shader, tri, tested)
+                       : shading::fill_samples<8>(target, shader, tri, tested);
+    STAT_ADD(STAT_PIXELS_TESTED, tested);
+    return written;
+  }
+  int written = with_framebuffer(*target.image, [&](const auto &fb) {
+    return shading::fill(target, fb, shader, tri, tested);
+  });
+  STAT_ADD(STAT_PIXELS_TESTED, tested);
+  return written;
+}
+
+// mesh() with a shader of the caller's choosing. opts.rasterizer, hiz,
+// sort_faces and light_dir do not apply (lighting is up to the shader). With
+// opts.threads != 1 faces are set up in parallel and the screen is cut into
+// horizontal bands, each drawn by one worker, with the same pixels as the
+// serial path. With opts.samples > 1 the frame is drawn into the context's
+// MultisampleBuffer and resolved into image at the end.
+template <class Shader>
+void mesh_shaded(const Model *model, Shader &shader, TGAImage &image,
+                 const RenderOptions &opts, RenderContext &context) {
+  context.arena.reset();
+  const int width = image.get_width(), height = image.get_height();
+  const int nFaces = model->nfaces();
+  STAT_ADD(STAT_FRAMES, 1);
+  STAT_ADD(STAT_FACES_SUBMITTED, nFaces);
+  Visibility visibility = mesh_visibility(model, width, height, opts.transform);
+  if (visibility == OUTSIDE) {
+    STAT_ADD(STAT_FACES_CULLED, nFaces);
+    return;
+  }
+
+  MultisampleBuffer *msaa = nullptr;
+  if (opts.samples > 1) {
+    msaa = &context.keep<MultisampleBuffer>();
+    msaa->reset(width, height, opts.samples);
+  } else {
+    context.zbuffer.assign(width * height,
+                           -std::numeric_limits<float>::max());
+  }
+  VertexBuffer &vertices = context.vertices;
+  process_vertices(model, width, height, vertices, opts.threads,
+                   opts.transform);
+  {
+    STAT_SCOPE(STAGE_SETUP);
+    shader.begin(model, vertices);
+  }
+
+  const int workers = resolve_threads(opts.threads);
+  if (workers == 1) {
+    // With samples the depth lives in msaa alone.
+    RasterTarget target{&image, msaa ? nullptr : context.zbuffer.data(),
+                        width, 0, 0, width, height};
+    target.msaa = msaa;
+    // Set up in one pass and drawn in a second, face order kept, so that
+    // each stage is timed once rather than per face.
+    std::vector<ShadedTriangle<Shader>> &tris =
+        context.keep<std::vector<ShadedTriangle<Shader>>>();
+    tris.clear();
+    ShadedTriangle<Shader> clipped[5];
+    int culled = 0, written = 0;
+    STAT_WATCH(watch);
+    for (int i = 0; i < nFaces; i++) {
+      int n = shading::setup(model, vertices, shader, i, visibility, width,
+                             height, opts, clipped);
+      culled += n == 0;
+      tris.insert(tris.end(), clipped, clipped + n);
+    }
+    STAT_LAP(watch, STAGE_SETUP);
+    for (const ShadedTriangle<Shader> &tri : tris)
+      written += shade_triangle(target, shader, tri);
+    STAT_LAP(watch, STAGE_RASTER);
+    STAT_ADD(STAT_FACES_CULLED, culled);
+    STAT_ADD(STAT_TRIANGLES_RASTERIZED, tris.size());
+    STAT_ADD(STAT_PIXELS_WRITTEN, written);
+    if (msaa) {
+      STAT_SCOPE(STAGE_RESOLVE);
+      msaa->resolve(image);
+    }
+    return;
+  }
+
+  const int nbands = std::min(height, workers * 4);
+  const int band = (height + nbands - 1) / nbands;
+  const int nChunks =
+      (nFaces + shading::faces_per_chunk - 1) / shading::faces_per_chunk;
+  std::vector<shading::Chunk<Shader>> &chunks =
+      context.keep<std::vector<shading::Chunk<Shader>>>();
+  chunks.resize(nChunks);
+  {
+    STAT_SCOPE(STAGE_SETUP);
+    parallel_for(nChunks, workers, [&](int c, int) {
+      shading::Chunk<Shader> &chunk = chunks[c];
+      chunk.tris.clear();
+      chunk.bins.resize(nbands);
+      for (std::vector<int> &bin : chunk.bins)
+        bin.clear();
+      int end = std::min(nFaces, (c + 1) * shading::faces_per_chunk);
+      ShadedTriangle<Shader> clipped[5];
+      int culled = 0;
+      for (int i = c * shading::faces_per_chunk; i < end; i++) {
+        int n = shading::setup(model, vertices, shader, i, visibility, width,
+                               height, opts, clipped);
+        culled += n == 0;
+        for (int k = 0; k < n; k++) {
+          const Vec3f *p = clipped[k].pts;
+          float minY = std::min({p[0].y, p[1].y, p[2].y});
+          float maxY = std::max({p[0].y, p[1].y, p[2].y});
+          // The rows fill() and fill_samples() walk: multisampled pixels
+          // reach the rows whose samples lie within half a pixel of the
+          // corners.
+          int first, last;
+          if (msaa) {
+            first = std::max(0, int(std::floor(minY - .5f)) + 1);
+            last = std::min(height - 1, int(std::ceil(maxY + .5f)) - 1);
+          } else {
+            minY = std::max(0.f, minY);
+            maxY = std::min(float(height - 1), maxY);
+            if (!(minY < maxY))
+              continue;
+            first = int(minY);
+            last = int(maxY) - 1;
+          }
+          if (first > last)
+            continue;
+          int index = (int)chunk.tris.size();
+          chunk.tris.push_back(clipped[k]);
+          for (int b = first / band; b <= last / band; b++)
+            chunk.bins[b].push_back(index);
+        }
+      }
+      STAT_ADD(STAT_FACES_CULLED, culled);
+      STAT_ADD(STAT_TRIANGLES_RASTERIZED, chunk.tris.size());
+    });
+  }
+
+  // Bands share the frame's depth buffer but never a row of it.
+  {
+    STAT_SCOPE(STAGE_RASTER);
+    parallel_for(nbands, workers, [&](int b, int) {
+      RasterTarget target{&image, msaa ? nullptr : context.zbuffer.data(),
+                          width, 0, 0, width, height};
+      target.y0 = b * band;
+      target.y1 = std::min(height, target.y0 + band);
+      if (target.zbuffer)
+        target.zbuffer += (size_t)target.y0 * width;
+      target.msaa = msaa;
+      int written = 0;
+      for (const shading::Chunk<Shader> &chunk : chunks)
+        for (int index : chunk.bins[b])
+          written += shade_triangle(target, shader, chunk.tris[index]);
+      STAT_ADD(STAT_PIXELS_WRITTEN, written);
+    });
+  }
+  if (msaa) {
+    STAT_SCOPE(STAGE_RESOLVE);
+    msaa->resolve(image, workers);
+  }
+}
+
+template <class Shader>
+void mesh_shaded(const Model *model, Shader &shader, TGAImage &image,
+                 const RenderOptions &opts = RenderOptions()) {
+  RenderContext context;
+  mesh_shaded(model, shader, image, opts, context);
+}
+
+#endif //__SHADER_H__
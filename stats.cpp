@@ -0,0 +1,88 @@
+#include "stats.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+const char *stage_names[STAGE_COUNT] = {
+    "load", "vertex", "setup", "raster", "resolve", "flip", "encode"};
+const char *counter_names[STAT_COUNT] = {
+    "frames",           "faces_submitted",       "faces_culled",
+    "faces_clipped",    "triangles_rasterized",  "triangles_hiz_rejected",
+    "pixels_tested",    "pixels_written",        "bytes_loaded",
+    "bytes_image",      "bytes_encoded"};
+
+// Totals are spread over slots on their own cache lines, each thread adding
+// to one slot, so workers counting at the same time don't contend. Reads sum
+// every slot.
+const int nslots = 64;
+
+struct alignas(64) Slot {
+  std::atomic<uint64_t> stage_ns[STAGE_COUNT];
+  std::atomic<uint64_t> counters[STAT_COUNT];
+};
+
+Slot slots[nslots];
+std::atomic<unsigned> next_slot{0};
+
+Slot &local_slot() {
+  thread_local Slot &slot = slots[next_slot++ % nslots];
+  return slot;
+}
+
+uint64_t total_ns(int stage) {
+  uint64_t sum = 0;
+  for (const Slot &slot : slots)
+    sum += slot.stage_ns[stage].load(std::memory_order_relaxed);
+  return sum;
+}
+
+uint64_t total(int counter) {
+  uint64_t sum = 0;
+  for (const Slot &slot : slots)
+    sum += slot.counters[counter].load(std::memory_order_relaxed);
+  return sum;
+}
+
+std::string exit_path;
+
+void write_at_exit() { stats_write_json(exit_path.c_str()); }
+
+} // namespace
+
+void stat_add(StatCounter counter, uint64_t n) {
+  local_slot().counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void stat_time(StatStage stage, std::chrono::steady_clock::duration elapsed) {
+  uint64_t ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  local_slot().stage_ns[stage].fetch_add(ns, std::memory_order_relaxed);
+}
+
+bool stats_write_json(const char *filename) {
+  FILE *out = fopen(filename, "w");
+  if (!out) {
+    fprintf(stderr, "can't open file %s\n", filename);
+    return false;
+  }
+  fprintf(out, "{\n  \"enabled\": %s,\n  \"stages_ms\": {",
+          RENDER_STATS ? "true" : "false");
+  for (int i = 0; i < STAGE_COUNT; i++)
+    fprintf(out, "%s\n    \"%s\": %.3f", i ? "," : "", stage_names[i],
+            total_ns(i) / 1e6);
+  fprintf(out, "\n  },\n  \"counters\": {");
+  for (int i = 0; i < STAT_COUNT; i++)
+    fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "", counter_names[i],
+            (unsigned long long)total(i));
+  fprintf(out, "\n  }\n}\n");
+  return fclose(out) == 0;
+}
+
+void stats_write_json_at_exit(const char *filename) {
+  if (exit_path.empty())
+    std::atexit(write_at_exit);
+  exit_path = filename;
+}
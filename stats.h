@@ -0,0 +1,93 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <chrono>
+#include <cstdint>
+
+// Render instrumentation: wall time per pipeline stage plus work counters,
+// kept in process wide totals and dumped as JSON on request.
+//
+// Everything is updated through the STAT_* macros below, which expand to
+// nothing when built with -DRENDER_STATS=0, so a build without them carries
+// no trace of the bookkeeping. Counters are bumped once per batch of work (a
+// triangle, a chunk of faces), never per pixel, into per thread slots, which
+// keeps them cheap and safe to use from every render worker.
+
+#ifndef RENDER_STATS
+#define RENDER_STATS 1
+#endif
+
+enum StatStage {
+  STAGE_LOAD,    // parsing or mapping the model
+  STAGE_VERTEX,  // process_vertices()
+  STAGE_SETUP,   // face assembly, lighting, culling, clipping and binning
+  STAGE_RASTER,  // coverage, depth test and pixel writes
+  STAGE_RESOLVE, // averaging multisampled pixels into the image
+  STAGE_FLIP,    // flip_vertically() before writing
+  STAGE_ENCODE,  // TGA encoding and the write itself
+  STAGE_COUNT
+};
+
+enum StatCounter {
+  STAT_FRAMES,                 // mesh() calls
+  STAT_FACES_SUBMITTED,        // faces handed to setup
+  STAT_FACES_CULLED,           // dropped by setup: facing away, off screen
+  STAT_FACES_CLIPPED,          // cut at the guard band into new triangles
+  STAT_TRIANGLES_RASTERIZED,   // triangles handed to the rasterizer
+  STAT_TRIANGLES_HIZ_REJECTED, // of those, proven hidden as a whole
+  STAT_PIXELS_TESTED,          // covered pixels that reached the depth test
+  STAT_PIXELS_WRITTEN,         // pixels that passed it and were written
+  STAT_BYTES_LOADED,           // model file bytes
+  STAT_BYTES_IMAGE,            // uncompressed pixel bytes handed to encoding
+  STAT_BYTES_ENCODED,          // bytes of TGA written
+  STAT_COUNT
+};
+
+void stat_add(StatCounter counter, uint64_t n);
+void stat_time(StatStage stage, std::chrono::steady_clock::duration elapsed);
+
+// Writes every stage time and counter as one JSON object. Returns false when
+// the file can't be written.
+bool stats_write_json(const char *filename);
+// Arranges for stats_write_json(filename) to run when the process exits.
+void stats_write_json_at_exit(const char *filename);
+
+// Adds the lifetime of the object to a stage.
+class StageTimer {
+  StatStage stage_;
+  std::chrono::steady_clock::time_point start_;
+
+public:
+  explicit StageTimer(StatStage stage)
+      : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+  ~StageTimer() { stat_time(stage_, std::chrono::steady_clock::now() - start_); }
+};
+
+// Splits one stretch of time between stages that alternate, e.g. setting up
+// a face and then drawing it: every lap() charges the time since the previous
+// one to the given stage.
+class StageWatch {
+  std::chrono::steady_clock::time_point last_;
+
+public:
+  StageWatch() : last_(std::chrono::steady_clock::now()) {}
+  void lap(StatStage stage) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    stat_time(stage, now - last_);
+    last_ = now;
+  }
+};
+
+#if RENDER_STATS
+#define STAT_ADD(counter, n) stat_add(counter, n)
+#define STAT_SCOPE(stage) StageTimer stat_scope_timer(stage)
+#define STAT_WATCH(watch) StageWatch watch
+#define STAT_LAP(watch, stage) watch.lap(stage)
+#else
+#define STAT_ADD(counter, n) ((void)sizeof(n))
+#define STAT_SCOPE(stage) ((void)0)
+#define STAT_WATCH(watch) ((void)0)
+#define STAT_LAP(watch, stage) ((void)0)
+#endif
+
+#endif //__STATS_H__
@@ -0,0 +1,116 @@
+#include "texture.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Average of four texels, channel by channel, rounded.
+inline uint32_t average(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+  uint32_t out = 0;
+  for (int shift = 0; shift < 32; shift += 8) {
+    uint32_t sum = (a >> shift & 0xff) + (b >> shift & 0xff) +
+                   (c >> shift & 0xff) + (d >> shift & 0xff);
+    out |= ((sum + 2) / 4) << shift;
+  }
+  return out;
+}
+
+// a + (b - a) * t per channel, t in 1/256 steps.
+inline uint32_t lerp(uint32_t a, uint32_t b, uint32_t t) {
+  // blue and red in one word, green and alpha in another, each channel with
+  // 8 bits of headroom above it
+  uint32_t a0 = a & 0x00ff00ff, b0 = b & 0x00ff00ff;
+  uint32_t a1 = a >> 8 & 0x00ff00ff, b1 = b >> 8 & 0x00ff00ff;
+  uint32_t lo = (a0 * (256 - t) + b0 * t) >> 8 & 0x00ff00ff;
+  uint32_t hi = (a1 * (256 - t) + b1 * t) & 0xff00ff00;
+  return lo | hi;
+}
+
+// std::floor is a library call without SSE4.1, this is two instructions.
+inline int floor_int(float f) {
+  int i = (int)f;
+  return i - (f < i);
+}
+
+} // namespace
+
+Texture::Texture(TGAImage &image) {
+  const int w = image.get_width(), h = image.get_height();
+  const int bpp = image.get_bytespp();
+  if (w <= 0 || h <= 0 || !image.buffer())
+    return;
+
+  // Lay out every level first, each starting on a whole tile.
+  size_t texels = 0;
+  for (int lw = w, lh = h;;) {
+    Level l;
+    l.width = lw;
+    l.height = lh;
+    l.tiles_x = (lw + 7) / 8;
+    l.offset = texels;
+    levels_.push_back(l);
+    texels += (size_t)l.tiles_x * ((lh + 7) / 8) * 64;
+    if (lw == 1 && lh == 1)
+      break;
+    lw = std::max(1, lw / 2);
+    lh = std::max(1, lh / 2);
+  }
+  texels_.assign(texels, 0);
+
+  // Level 0 straight from the image, whose first row is the top one.
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      const unsigned char *p = image.pixel(x, h - 1 - y);
+      uint32_t t;
+      if (bpp == 1)
+        t = p[0] | p[0] << 8 | p[0] << 16 | 0xffu << 24;
+      else
+        t = p[0] | p[1] << 8 | p[2] << 16 |
+            (bpp == 4 ? (uint32_t)p[3] : 0xffu) << 24;
+      texels_[address(levels_[0], x, y)] = t;
+    }
+  }
+
+  // Then every level from the one above it, clamping at odd edges.
+  for (size_t i = 1; i < levels_.size(); i++) {
+    const Level &src = levels_[i - 1], &dst = levels_[i];
+    for (int y = 0; y < dst.height; y++) {
+      int y0 = std::min(2 * y, src.height - 1);
+      int y1 = std::min(2 * y + 1, src.height - 1);
+      for (int x = 0; x < dst.width; x++) {
+        int x0 = std::min(2 * x, src.width - 1);
+        int x1 = std::min(2 * x + 1, src.width - 1);
+        texels_[address(dst, x, y)] = average(
+            texels_[address(src, x0, y0)], texels_[address(src, x1, y0)],
+            texels_[address(src, x0, y1)], texels_[address(src, x1, y1)]);
+      }
+    }
+  }
+}
+
+int Texture::level_for(float texels_per_pixel) const {
+  if (!(texels_per_pixel > 1))
+    return 0;
+  int level = (int)std::floor(std::log2(texels_per_pixel) + .5f);
+  return std::min(level, levels() - 1);
+}
+
+uint32_t Texture::nearest(int level, float u, float v) const {
+  const Level &l = levels_[level];
+  return texel(level, floor_int(u * l.width), floor_int(v * l.height));
+}
+
+uint32_t Texture::bilinear(int level, float u, float v) const {
+  const Level &l = levels_[level];
+  // texel centers sit at half integers
+  float fx = u * l.width - .5f, fy = v * l.height - .5f;
+  int x0 = floor_int(fx), y0 = floor_int(fy);
+  uint32_t tx = (uint32_t)((fx - x0) * 256), ty = (uint32_t)((fy - y0) * 256);
+  // wrap once, the neighbors only ever step past the last texel
+  int xa = wrap(x0, l.width), ya = wrap(y0, l.height);
+  int xb = xa + 1 < l.width ? xa + 1 : 0, yb = ya + 1 < l.height ? ya + 1 : 0;
+  const uint32_t *t = texels_.data();
+  uint32_t bottom = lerp(t[address(l, xa, ya)], t[address(l, xb, ya)], tx);
+  uint32_t top = lerp(t[address(l, xa, yb)], t[address(l, xb, yb)], tx);
+  return lerp(bottom, top, ty);
+}
@@ -0,0 +1,67 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include "tgaimage.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A TGAImage prepared for sampling.
+//
+// Texels are widened to four bytes (B G R A, the TGAColor layout) and every
+// level of the mip chain, down to 1x1, is built up front by 2x2 box
+// filtering. Within a level texels are stored in 8x8 tiles, 256 bytes each,
+// with the texels of a tile in Morton (Z) order and the tiles row by row. A
+// bilinear footprint, and the run of footprints a triangle walks in any
+// direction, then mostly stays within a handful of cache lines, where a row
+// major image hands out a new line for every texel moved vertically.
+//
+// Coordinates follow the obj convention: u runs left to right and v bottom to
+// top over [0, 1], repeating outside of it.
+class Texture {
+public:
+  Texture() {}
+  explicit Texture(TGAImage &image);
+
+  bool empty() const { return levels_.empty(); }
+  int levels() const { return (int)levels_.size(); }
+  int width(int level = 0) const { return levels_[level].width; }
+  int height(int level = 0) const { return levels_[level].height; }
+
+  // The level whose texels come closest to one per pixel, given how many
+  // level 0 texels a step of one pixel crosses.
+  int level_for(float texels_per_pixel) const;
+
+  // Texel (x, y) of a level, y counted from the bottom, wrapped.
+  uint32_t texel(int level, int x, int y) const {
+    const Level &l = levels_[level];
+    return texels_[address(l, wrap(x, l.width), wrap(y, l.height))];
+  }
+  uint32_t nearest(int level, float u, float v) const;
+  uint32_t bilinear(int level, float u, float v) const;
+
+private:
+  struct Level {
+    int width, height;
+    int tiles_x;   // tiles per row of tiles
+    size_t offset; // first texel in texels_
+  };
+  std::vector<Level> levels_;
+  std::vector<uint32_t> texels_;
+
+  // Into [0, size), a mask for the usual power of two sizes.
+  static int wrap(int i, int size) {
+    if (!(size & (size - 1)))
+      return i & (size - 1);
+    i %= size;
+    return i < 0 ? i + size : i;
+  }
+  static size_t address(const Level &l, int x, int y) {
+    // bits 0 to 2 of x and y interleaved, x in the even bits
+    static const uint8_t spread[8] = {0, 1, 4, 5, 16, 17, 20, 21};
+    return l.offset + ((size_t)(y >> 3) * l.tiles_x + (x >> 3)) * 64 +
+           (spread[x & 7] | spread[y & 7] << 1);
+  }
+};
+
+#endif //__TEXTURE_H__
@@ -1,14 +1,28 @@
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "mmapfile.h"
+#include "parallel.h"
+#include "stats.h"
 #include "tgaimage.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0), tiled(false) {
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), tiled(false) {
 	unsigned long nbytes = width*height*bytespp;
 	data = new unsigned char[nbytes];
 	memset(data, 0, nbytes);
@@ -18,7 +32,8 @@ TGAImage::TGAImage(const TGAImage &img) {
 	width = img.width;
 	height = img.height;
 	bytespp = img.bytespp;
-	unsigned long nbytes = width*height*bytespp;
+	tiled = img.tiled;
+	unsigned long nbytes = img.buffer_bytes();
 	data = new unsigned char[nbytes];
 	memcpy(data, img.data, nbytes);
 }
@@ -33,7 +48,8 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 		width  = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
-		unsigned long nbytes = width*height*bytespp;
+		tiled = img.tiled;
+		unsigned long nbytes = img.buffer_bytes();
 		data = new unsigned char[nbytes];
 		memcpy(data, img.data, nbytes);
 	}
@@ -43,119 +59,203 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 bool TGAImage::read_tga_file(const char *filename) {
 	if (data) delete [] data;
 	data = NULL;
-	std::ifstream in;
-	in.open (filename, std::ios::binary);
-	if (!in.is_open()) {
+	tiled = false;
+	MappedFile file;
+	if (!file.open(filename)) {
 		std::cerr << "can't open file " << filename << "\n";
-		in.close();
 		return false;
 	}
+	const unsigned char *in = (const unsigned char *)file.data();
+	const unsigned char *end = in + file.size();
 	TGA_Header header;
-	in.read((char *)&header, sizeof(header));
-	if (!in.good()) {
-		in.close();
+	if (file.size()<sizeof(header)) {
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
+	memcpy((void *)&header, in, sizeof(header));
 	width   = header.width;
 	height  = header.height;
 	bytespp = header.bitsperpixel>>3;
 	if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
-		in.close();
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
-	unsigned long nbytes = bytespp*width*height;
+	// the image id and an (unused) color map sit between header and pixels
+	unsigned long skip = sizeof(header) + (unsigned char)header.idlength;
+	if (header.colormaptype)
+		skip += (unsigned long)(unsigned short)header.colormaplength*(((unsigned char)header.colormapdepth+7)>>3);
+	if (skip>file.size()) {
+		std::cerr << "an error occured while reading the header\n";
+		return false;
+	}
+	in += skip;
+
+	// Bottom-up files are flipped while decoding, each stored row going
+	// straight to its final place.
+	bool bottom_up = !(header.imagedescriptor & 0x20);
+	unsigned long rowbytes = (unsigned long)width*bytespp;
+	unsigned long nbytes = rowbytes*height;
 	data = new unsigned char[nbytes];
 	if (3==header.datatypecode || 2==header.datatypecode) {
-		in.read((char *)data, nbytes);
-		if (!in.good()) {
-			in.close();
+		if ((unsigned long)(end-in)<nbytes) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
+		if (!bottom_up) {
+			memcpy(data, in, nbytes);
+		} else {
+			for (int y=0; y<height; y++)
+				memcpy(data+(height-1-y)*rowbytes, in+y*rowbytes, rowbytes);
+		}
 	} else if (10==header.datatypecode||11==header.datatypecode) {
-		if (!load_rle_data(in)) {
-			in.close();
+		if (!decode_rle_data(in, end, bottom_up)) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
 	} else {
-		in.close();
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
 		return false;
 	}
-	if (!(header.imagedescriptor & 0x20)) {
-		flip_vertically();
-	}
 	if (header.imagedescriptor & 0x10) {
 		flip_horizontally();
 	}
 	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
-	in.close();
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte  = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
-			std::cerr << "an error occured while reading the data\n";
+namespace {
+
+// Repeats the pixel over n bytes of dst (a whole number of pixels), doubling
+// the filled part on every copy.
+inline void fill_pixels(unsigned char *dst, const unsigned char *pixel, unsigned long n, int bytespp) {
+	if (bytespp==1) {
+		memset(dst, pixel[0], n);
+		return;
+	}
+	memcpy(dst, pixel, bytespp);
+	for (unsigned long done=bytespp; done<n; ) {
+		unsigned long k = std::min(done, n-done);
+		memcpy(dst+done, dst, k);
+		done += k;
+	}
+}
+
+}
+
+// Packets may span scanlines, so each one is cut at row ends; raw packets are
+// copied and run packets filled a row piece at a time.
+bool TGAImage::decode_rle_data(const unsigned char *in, const unsigned char *end, bool bottom_up) {
+	const unsigned long rowbytes = (unsigned long)width*bytespp;
+	auto row_start = [&](int y) { return data + (bottom_up ? height-1-y : y)*rowbytes; };
+	int y = 0;
+	unsigned char *dst = row_start(0);
+	unsigned long left = rowbytes; // still to fill in the current row
+	while (y<height) {
+		if (in>=end) {
+			std::cerr << "an error occured while reading the header\n";
 			return false;
 		}
-		if (chunkheader<128) {
-			chunkheader++;
-			for (int i=0; i<chunkheader; i++) {
-				in.read((char *)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		} else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
+		unsigned char chunkheader = *in++;
+		bool run = chunkheader>=128;
+		unsigned long todo = ((chunkheader&127)+1)*bytespp;
+		unsigned long packet = run ? bytespp : todo;
+		if ((unsigned long)(end-in)<packet) {
+			std::cerr << "an error occured while reading the header\n";
+			return false;
+		}
+		const unsigned char *src = in;
+		in += packet;
+		while (todo) {
+			if (y>=height) {
+				std::cerr << "Too many pixels read\n";
 				return false;
 			}
-			for (int i=0; i<chunkheader; i++) {
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
+			unsigned long n = std::min(todo, left);
+			if (run) {
+				fill_pixels(dst, src, n, bytespp);
+			} else {
+				memcpy(dst, src, n);
+				src += n;
 			}
+			dst += n;
+			left -= n;
+			todo -= n;
+			if (!left && ++y<height) {
+				dst = row_start(y);
+				left = rowbytes;
+			}
+		}
+	}
+	return true;
+}
+
+namespace {
+
+// Bytes [0, n) over which a and b agree. Compares 16 bytes per step with
+// SSE2, 8 otherwise.
+unsigned long common_prefix(const unsigned char *a, const unsigned char *b, unsigned long n) {
+	unsigned long i = 0;
+#if defined(__SSE2__)
+	for (; i+16<=n; i+=16) {
+		__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a+i)), _mm_loadu_si128((const __m128i *)(b+i)));
+		unsigned int mask = _mm_movemask_epi8(eq) ^ 0xFFFF;
+		if (mask) return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i+8<=n; i+=8) {
+		uint64_t x, y;
+		memcpy(&x, a+i, 8);
+		memcpy(&y, b+i, 8);
+		if (x!=y) return i + (__builtin_ctzll(x^y)>>3); // little endian
+	}
+	while (i<n && a[i]==b[i]) i++;
+	return i;
+}
+
+inline bool same_pixel(const unsigned char *a, const unsigned char *b, int bytespp) {
+	switch (bytespp) {
+	case 4: {
+		uint32_t x, y;
+		memcpy(&x, a, 4);
+		memcpy(&y, b, 4);
+		return x==y;
+	}
+	case 3: return a[0]==b[0] && a[1]==b[1] && a[2]==b[2];
+	default: return a[0]==b[0];
+	}
+}
+
+// Writes every byte of iov, however many writev calls the OS needs.
+bool write_all(int fd, std::vector<iovec> &iov) {
+	size_t first = 0;
+	while (first<iov.size()) {
+		int count = (int)std::min(iov.size()-first, (size_t)IOV_MAX);
+		ssize_t done = writev(fd, iov.data()+first, count);
+		if (done<0) {
+			if (errno==EINTR) continue;
+			return false;
 		}
-	} while (currentpixel < pixelcount);
+		while (first<iov.size() && (size_t)done>=iov[first].iov_len) {
+			done -= iov[first].iov_len;
+			first++;
+		}
+		if (first<iov.size()) {
+			iov[first].iov_base = (char *)iov[first].iov_base + done;
+			iov[first].iov_len -= done;
+		}
+	}
 	return true;
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
+const int rows_per_band = 64;
+
+}
+
+bool TGAImage::write_tga_file(const char *filename, bool rle, int threads) {
+	STAT_SCOPE(STAGE_ENCODE);
 	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
 	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
 	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-	std::ofstream out;
-	out.open (filename, std::ios::binary);
-	if (!out.is_open()) {
-		std::cerr << "can't open file " << filename << "\n";
-		out.close();
-		return false;
-	}
 	TGA_Header header;
 	memset((void *)&header, 0, sizeof(header));
 	header.bitsperpixel = bytespp<<3;
@@ -163,103 +263,129 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	header.height = height;
 	header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
 	header.imagedescriptor = 0x20; // top-left origin
-	out.write((char *)&header, sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
-	}
+
+	std::vector<iovec> iov;
+	iov.push_back(iovec{(void *)&header, sizeof(header)});
+
+	// Bands of scanlines are packed independently into their own buffers and
+	// handed to writev as they are, no joining copy. Packets never cross a band
+	// boundary but may cross scanlines within one, as they always have here.
+	// A tiled image is put back into scanlines here, a band at a time.
+	std::vector<std::vector<unsigned char> > bands;
+	std::vector<unsigned char> linear;
+	const unsigned long rowbytes = (unsigned long)width*bytespp;
 	if (!rle) {
-		out.write((char *)data, width*height*bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
+		const unsigned char *pixels = data;
+		if (tiled) {
+			linear.resize(rowbytes*height);
+			int nbands = (height+rows_per_band-1)/rows_per_band;
+			parallel_for(nbands, threads, [&](int b, int) {
+				int y0 = b*rows_per_band, y1 = std::min(height, y0+rows_per_band);
+				copy_rows(y0, y1, linear.data()+y0*rowbytes);
+			});
+			pixels = linear.data();
 		}
+		iov.push_back(iovec{(void *)pixels, (size_t)width*height*bytespp});
 	} else {
-		if (!unload_rle_data(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
-		}
-	}
-	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+		int nbands = (height+rows_per_band-1)/rows_per_band;
+		bands.resize(nbands);
+		std::vector<std::vector<unsigned char> > rows(tiled ? resolve_threads(threads) : 0);
+		parallel_for(nbands, threads, [&](int b, int worker) {
+			int y0 = b*rows_per_band, y1 = std::min(height, y0+rows_per_band);
+			const unsigned char *pixels = data+y0*rowbytes;
+			if (tiled) {
+				rows[worker].resize(rows_per_band*rowbytes);
+				copy_rows(y0, y1, rows[worker].data());
+				pixels = rows[worker].data();
+			}
+			// worst case is all raw, one header byte per 128 pixels
+			unsigned long npixels = (unsigned long)(y1-y0)*width;
+			bands[b].resize(npixels*bytespp + (npixels+127)/128);
+			bands[b].resize(encode_rle_rows(pixels, y1-y0, bands[b].data()));
+		});
+		for (std::vector<unsigned char> &band : bands)
+			iov.push_back(iovec{(void *)band.data(), band.size()});
 	}
-	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
+	iov.push_back(iovec{(void *)developer_area_ref, sizeof(developer_area_ref)});
+	iov.push_back(iovec{(void *)extension_area_ref, sizeof(extension_area_ref)});
+	iov.push_back(iovec{(void *)footer, sizeof(footer)});
+
+	unsigned long total = 0;
+	for (const iovec &v : iov) total += v.iov_len;
+	STAT_ADD(STAT_BYTES_IMAGE, (unsigned long)width*height*bytespp);
+	STAT_ADD(STAT_BYTES_ENCODED, total);
+
+	int fd = ::open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd<0) {
+		std::cerr << "can't open file " << filename << "\n";
 		return false;
 	}
-	out.write((char *)footer, sizeof(footer));
-	if (!out.good()) {
+	bool ok = write_all(fd, iov);
+	if (::close(fd)!=0) ok = false;
+	if (!ok) {
 		std::cerr << "can't dump the tga file\n";
-		out.close();
 		return false;
 	}
-	out.close();
 	return true;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
-	unsigned long curpix = 0;
-	while (curpix<npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix+run_length<npixels && run_length<max_chunk_length) {
-			bool succ_eq = true;
-			for (int t=0; succ_eq && t<bytespp; t++) {
-				succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-			}
-			curbyte += bytespp;
-			if (1==run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
+// Packs nrows scanlines starting at pixels into out and returns the number of
+// bytes used.
+// Two equal pixels inside raw data only end the raw packet when a run packet
+// plus the next raw header is smaller than leaving them raw, which is the case
+// from 3 bytes per pixel up; grayscale keeps them raw.
+unsigned long TGAImage::encode_rle_rows(const unsigned char *pixels, int nrows, unsigned char *out) {
+	const int max_chunk_length = 128;
+	const int min_split_run = bytespp>2 ? 2 : 3;
+	const long npixels = (long)nrows*width;
+	unsigned char *o = out;
+	long raw_start = 0;
+	long x = 0;
+	auto flush_raw = [&](long upto) {
+		while (raw_start<upto) {
+			int n = (int)std::min(upto-raw_start, (long)max_chunk_length);
+			*o++ = n-1;
+			memcpy(o, pixels+raw_start*bytespp, n*bytespp);
+			o += n*bytespp;
+			raw_start += n;
 		}
-		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+	};
+	while (x<npixels) {
+		int run = 1;
+		if (x+1<npixels && same_pixel(pixels+x*bytespp, pixels+(x+1)*bytespp, bytespp)) {
+			// pixels from x on are equal for as long as the data agrees with
+			// itself shifted by one pixel
+			long limit = std::min(npixels-x, (long)max_chunk_length);
+			unsigned long agree = common_prefix(pixels+x*bytespp, pixels+(x+1)*bytespp, (limit-1)*bytespp);
+			run = 1 + (int)(agree/bytespp);
 		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+		if (run>=min_split_run || (run==2 && raw_start==x)) {
+			flush_raw(x);
+			*o++ = run+127;
+			memcpy(o, pixels+x*bytespp, bytespp);
+			o += bytespp;
+			x += run;
+			raw_start = x;
+		} else {
+			x++;
 		}
 	}
-	return true;
+	flush_raw(npixels);
+	return o-out;
 }
 
 TGAColor TGAImage::get(int x, int y) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return TGAColor();
 	}
-	return TGAColor(data+(x+y*width)*bytespp, bytespp);
+	return TGAColor(pixel(x, y), bytespp);
 }
 
 bool TGAImage::set(int x, int y, TGAColor c) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return false;
 	}
-	memcpy(data+(x+y*width)*bytespp, c.raw, bytespp);
+	memcpy(pixel(x, y), c.raw, bytespp);
 	return true;
 }
 
@@ -291,17 +417,36 @@ bool TGAImage::flip_horizontally() {
 
 bool TGAImage::flip_vertically() {
 	if (!data) return false;
+	STAT_SCOPE(STAGE_FLIP);
+	if (tiled) {
+		// Rows are runs of TILE pixels, one per column of tiles.
+		unsigned char line[TILE*4];
+		const unsigned long bytes = TILE*bytespp;
+		for (int j=0; j<height/2; j++) {
+			for (int x=0; x<width; x+=TILE) {
+				unsigned char *a = pixel(x, j), *b = pixel(x, height-1-j);
+				memcpy(line, a, bytes);
+				memcpy(a, b, bytes);
+				memcpy(b, line, bytes);
+			}
+		}
+		return true;
+	}
+	// Rows are swapped a piece at a time through the stack, nothing is
+	// allocated.
+	unsigned char line[4096];
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
 	int half = height>>1;
 	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
+		unsigned char *l1 = data+j*bytes_per_line;
+		unsigned char *l2 = data+(height-1-j)*bytes_per_line;
+		for (unsigned long x=0; x<bytes_per_line; x+=sizeof(line)) {
+			unsigned long n = std::min((unsigned long)sizeof(line), bytes_per_line-x);
+			memcpy(line,   l1+x, n);
+			memcpy(l1+x,   l2+x, n);
+			memcpy(l2+x,   line, n);
+		}
 	}
-	delete [] line;
 	return true;
 }
 
@@ -310,11 +455,56 @@ unsigned char *TGAImage::buffer() {
 }
 
 void TGAImage::clear() {
-	memset((void *)data, 0, width*height*bytespp);
+	memset((void *)data, 0, buffer_bytes());
+}
+
+unsigned long TGAImage::buffer_bytes() const {
+	if (!tiled) return (unsigned long)width*height*bytespp;
+	unsigned long tiles = (unsigned long)((width+TILE-1)/TILE)*((height+TILE-1)/TILE);
+	return tiles*TILE*TILE*bytespp;
+}
+
+// Scanlines [y0, y1) as plain rows, one after the other.
+void TGAImage::copy_rows(int y0, int y1, unsigned char *out) const {
+	const unsigned long rowbytes = (unsigned long)width*bytespp;
+	for (int y=y0; y<y1; y++, out+=rowbytes) {
+		if (!tiled) {
+			memcpy(out, data+y*rowbytes, rowbytes);
+			continue;
+		}
+		for (int x=0; x<width; x+=TILE)
+			memcpy(out+x*bytespp, pixel(x, y), std::min((int)TILE, width-x)*bytespp);
+	}
+}
+
+void TGAImage::set_tiled(bool t) {
+	if (t==tiled || !data) {
+		tiled = t;
+		return;
+	}
+	TGAImage old(*this);
+	delete [] data;
+	tiled = t;
+	unsigned long nbytes = buffer_bytes();
+	data = new unsigned char[nbytes];
+	memset(data, 0, nbytes);
+	const unsigned long rowbytes = (unsigned long)width*bytespp;
+	if (!tiled) {
+		old.copy_rows(0, height, data);
+		return;
+	}
+	for (int y=0; y<height; y++)
+		for (int x=0; x<width; x+=TILE)
+			memcpy(pixel(x, y), old.data+y*rowbytes+x*bytespp, std::min((int)TILE, width-x)*bytespp);
+}
+
+bool TGAImage::is_tiled() {
+	return tiled;
 }
 
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
+	set_tiled(false);
 	unsigned char *tdata = new unsigned char[w*h*bytespp];
 	int nscanline = 0;
 	int oscanline = 0;
@@ -66,19 +66,28 @@ protected:
 	int width;
 	int height;
 	int bytespp;
+	bool tiled;
 
-	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	bool   decode_rle_data(const unsigned char *in, const unsigned char *end, bool bottom_up);
+	unsigned long encode_rle_rows(const unsigned char *pixels, int nrows, unsigned char *out);
+	unsigned long buffer_bytes() const;
+	void copy_rows(int y0, int y1, unsigned char *out) const;
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
 	};
+	// Edge of the square tiles of a tiled image, in pixels.
+	enum { TILE=32 };
 
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
+	// Maps the file and decodes it straight into the pixel buffer, flipping
+	// bottom-up images on the way.
 	bool read_tga_file(const char *filename);
-	bool write_tga_file(const char *filename, bool rle=true);
+	// RLE encoding runs on up to `threads` workers (0 for one per core), each
+	// packing its own band of scanlines; the file goes out in a single write.
+	bool write_tga_file(const char *filename, bool rle=true, int threads=1);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -91,6 +100,22 @@ public:
 	int get_bytespp();
 	unsigned char *buffer();
 	void clear();
+
+	// A tiled image keeps its pixels in TILE x TILE tiles, the tiles row by
+	// row and the pixels of a tile row by row, padded to whole tiles. A tile
+	// is 4KB of RGBA, one page, and a triangle's neighborhood of pixels sits
+	// in a few of them where scanlines would hand out a line and a page per
+	// row. get(), set() and the Framebuffer of the image follow the layout,
+	// and write_tga_file() puts it back into scanlines on the way out.
+	// Switching converts the current contents.
+	void set_tiled(bool tiled);
+	bool is_tiled();
+	// Address of pixel (x, y) in buffer(), in either layout.
+	unsigned char *pixel(int x, int y) const {
+		if (!tiled) return data+((unsigned long)y*width+x)*bytespp;
+		unsigned long tile = (unsigned long)(y/TILE)*((width+TILE-1)/TILE) + x/TILE;
+		return data+(tile*TILE*TILE + (y%TILE)*TILE + x%TILE)*bytespp;
+	}
 };
 
 #endif //__IMAGE_H__
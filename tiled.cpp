@@ -0,0 +1,174 @@
+#include "tiled.h"
+#include "cull.h"
+#include "hiz.h"
+#include "parallel.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace {
+
+// The faces of one contiguous run of the model, already lit and projected,
+// together with the list of triangles landing in each tile. Bins hold indices
+// into tris in face order.
+struct Chunk {
+  std::vector<ScreenTriangle> tris;
+  std::vector<std::vector<int>> bins;
+};
+
+// What mesh_tiled() keeps in the render context from frame to frame: the
+// chunks with their bins, and per worker the hierarchical depth and the
+// buffers of the per tile sort.
+struct TiledState {
+  std::vector<Chunk> chunks;
+  std::vector<HiZBuffer> hiz;
+  std::vector<std::vector<ScreenTriangle>> sorted;
+  std::vector<std::vector<int>> order;
+};
+
+// Faces per setup chunk, small enough to spread the setup over every worker
+// and large enough that the per chunk bin lists stay cheap.
+const int faces_per_chunk = 1024;
+
+} // namespace
+
+void mesh_tiled(const Model *model, TGAImage &image,
+                const RenderOptions &opts, RenderContext &context) {
+  context.arena.reset();
+  TiledState &state = context.keep<TiledState>();
+  const int width = image.get_width(), height = image.get_height();
+  // On a tiled image the screen tiles cover whole image tiles, so a worker's
+  // depth buffer is the tiled depth of the pixels it writes.
+  int tile = std::max(1, opts.tile_size);
+  if (image.is_tiled())
+    tile = (tile + TGAImage::TILE - 1) / TGAImage::TILE * TGAImage::TILE;
+  const int tilesX = (width + tile - 1) / tile;
+  const int tilesY = (height + tile - 1) / tile;
+  const int nTiles = tilesX * tilesY;
+  const int nFaces = model->nfaces();
+  const int nChunks = (nFaces + faces_per_chunk - 1) / faces_per_chunk;
+
+  STAT_ADD(STAT_FRAMES, 1);
+  STAT_ADD(STAT_FACES_SUBMITTED, nFaces);
+  Visibility visibility =
+      mesh_visibility(model, width, height, opts.transform);
+  if (visibility == OUTSIDE) {
+    STAT_ADD(STAT_FACES_CULLED, nFaces);
+    return;
+  }
+
+  VertexBuffer &vertices = context.vertices;
+  process_vertices(model, width, height, vertices, opts.threads,
+                   opts.transform);
+
+  // Files a triangle under every tile its pixels can land in, going by the
+  // same [min, max) span clamped to the image that triangle2() walks.
+  auto bin = [&](Chunk &chunk, const ScreenTriangle &tri) {
+    float minX = std::numeric_limits<float>::max(), maxX = -minX;
+    float minY = minX, maxY = maxX;
+    for (int j = 0; j < 3; j++) {
+      minX = std::min(minX, tri.pts[j].x);
+      maxX = std::max(maxX, tri.pts[j].x);
+      minY = std::min(minY, tri.pts[j].y);
+      maxY = std::max(maxY, tri.pts[j].y);
+    }
+    minX = std::max(0.f, minX);
+    minY = std::max(0.f, minY);
+    maxX = std::min(float(width - 1), maxX);
+    maxY = std::min(float(height - 1), maxY);
+    if (!(minX < maxX && minY < maxY))
+      return;
+
+    int index = (int)chunk.tris.size();
+    chunk.tris.push_back(tri);
+    int tx0 = int(minX) / tile, tx1 = (int(std::ceil(maxX)) - 1) / tile;
+    int ty0 = int(minY) / tile, ty1 = (int(std::ceil(maxY)) - 1) / tile;
+    for (int ty = ty0; ty <= ty1; ty++)
+      for (int tx = tx0; tx <= tx1; tx++)
+        chunk.bins[ty * tilesX + tx].push_back(index);
+  };
+
+  // Setup and binning. Each chunk only writes its own bins, so the chunks run
+  // in parallel and concatenating them per tile restores face order.
+  std::vector<Chunk> &chunks = state.chunks;
+  chunks.resize(nChunks);
+  {
+    STAT_SCOPE(STAGE_SETUP);
+    parallel_for(nChunks, opts.threads, [&](int c, int) {
+      Chunk &chunk = chunks[c];
+      chunk.tris.clear();
+      chunk.bins.resize(nTiles);
+      for (std::vector<int> &bin : chunk.bins)
+        bin.clear();
+      int end = std::min(nFaces, (c + 1) * faces_per_chunk);
+      ScreenTriangle clipped[5];
+      int culled = 0;
+      for (int i = c * faces_per_chunk; i < end; i++) {
+        int n = setup_face(model, vertices, i, visibility, width, height, opts,
+                           clipped);
+        culled += n == 0;
+        for (int k = 0; k < n; k++)
+          bin(chunk, clipped[k]);
+      }
+      STAT_ADD(STAT_FACES_CULLED, culled);
+      STAT_ADD(STAT_TRIANGLES_RASTERIZED, chunk.tris.size());
+    });
+  }
+
+  // Rasterization, one tile at a time per worker. The depth buffers belong to
+  // the worker and are reset for every tile it picks up.
+  const int workers = std::min(resolve_threads(opts.threads), nTiles);
+  const size_t tile_pixels = (size_t)tile * tile;
+  float *depth = context.arena.alloc<float>(workers * tile_pixels);
+  std::vector<HiZBuffer> &hiz = state.hiz;
+  hiz.resize(workers);
+  state.sorted.resize(workers);
+  state.order.resize(workers);
+  STAT_SCOPE(STAGE_RASTER);
+  parallel_for(nTiles, workers, [&](int t, int worker) {
+    float *zbuffer = depth + worker * tile_pixels;
+    std::fill(zbuffer, zbuffer + tile_pixels,
+              -std::numeric_limits<float>::max());
+
+    RasterTarget target;
+    target.image = &image;
+    target.zbuffer = zbuffer;
+    target.zstride = tile;
+    target.x0 = (t % tilesX) * tile;
+    target.y0 = (t / tilesX) * tile;
+    target.x1 = std::min(width, target.x0 + tile);
+    target.y1 = std::min(height, target.y0 + tile);
+    if (opts.hiz) {
+      hiz[worker].reset(target.x0, target.y0, target.x1 - target.x0,
+                        target.y1 - target.y0);
+      target.hiz = &hiz[worker];
+    }
+
+    int written = 0;
+    if (!opts.sort_faces) {
+      for (const Chunk &chunk : chunks)
+        for (int index : chunk.bins[t])
+          written += draw_triangle(target, chunk.tris[index].color,
+                                   chunk.tris[index].pts, opts);
+      STAT_ADD(STAT_PIXELS_WRITTEN, written);
+      return;
+    }
+
+    // Sorting per tile is enough, tiles never share pixels.
+    std::vector<ScreenTriangle> &tris = state.sorted[worker];
+    std::vector<int> &tileOrder = state.order[worker];
+    tris.clear();
+    for (const Chunk &chunk : chunks)
+      for (int index : chunk.bins[t])
+        tris.push_back(chunk.tris[index]);
+    tileOrder.resize(tris.size());
+    for (size_t i = 0; i < tileOrder.size(); i++)
+      tileOrder[i] = (int)i;
+    sort_front_to_back(tileOrder.data(), (int)tileOrder.size(), tris.data());
+    for (int i : tileOrder)
+      written += draw_triangle(target, tris[i].color, tris[i].pts, opts);
+    STAT_ADD(STAT_PIXELS_WRITTEN, written);
+  });
+}
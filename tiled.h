@@ -0,0 +1,18 @@
+#ifndef __TILED_H__
+#define __TILED_H__
+
+#include "model.h"
+#include "raster.h"
+#include "tgaimage.h"
+
+// Renders the model in screen tiles on opts.threads workers.
+//
+// Faces are set up and binned into opts.tile_size square tiles in parallel,
+// then every tile is rasterized by exactly one worker against a depth buffer
+// of its own, writing only the pixels inside it. No two workers ever touch
+// the same pixel, so nothing is locked. Within a tile faces are drawn in model
+// order, which keeps the output identical to the serial mesh().
+void mesh_tiled(const Model *model, TGAImage &image,
+                const RenderOptions &opts, RenderContext &context);
+
+#endif //__TILED_H__
@@ -0,0 +1,93 @@
+#include "vertex.h"
+#include "parallel.h"
+#include "raster.h"
+#include "stats.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Vertices per parallel work item.
+const int vertices_per_chunk = 4096;
+
+// world2screen() over [begin, end). The SSE2 path does the same double
+// precision arithmetic on two vertices at a time and truncates the same way,
+// so both produce identical coordinates.
+void to_screen(const Vec3f *in, Vec3f *out, int begin, int end, int width,
+               int height) {
+  int i = begin;
+#if defined(__SSE2__)
+  const __m128d one = _mm_set1_pd(1.), two = _mm_set1_pd(2.);
+  const __m128d half = _mm_set1_pd(.5);
+  const __m128d w = _mm_set1_pd(width), h = _mm_set1_pd(height);
+  for (; i + 2 <= end; i += 2) {
+    __m128d x = _mm_setr_pd(in[i].x, in[i + 1].x);
+    __m128d y = _mm_setr_pd(in[i].y, in[i + 1].y);
+    x = _mm_add_pd(_mm_div_pd(_mm_mul_pd(_mm_add_pd(x, one), w), two), half);
+    y = _mm_add_pd(_mm_div_pd(_mm_mul_pd(_mm_add_pd(y, one), h), two), half);
+    __m128 sx = _mm_cvtepi32_ps(_mm_cvttpd_epi32(x));
+    __m128 sy = _mm_cvtepi32_ps(_mm_cvttpd_epi32(y));
+    float xs[4], ys[4];
+    _mm_storeu_ps(xs, sx);
+    _mm_storeu_ps(ys, sy);
+    out[i] = Vec3f(xs[0], ys[0], in[i].z);
+    out[i + 1] = Vec3f(xs[1], ys[1], in[i + 1].z);
+  }
+#endif
+  for (; i < end; i++)
+    out[i] = world2screen(in[i], width, height);
+}
+
+} // namespace
+
+void process_vertices(const Model *model, int width, int height,
+                      VertexBuffer &out, int threads,
+                      const ModelTransform &transform) {
+  STAT_SCOPE(STAGE_VERTEX);
+  const int n = model->nverts();
+  const bool place = !transform.identity();
+  const int nfaces = model->nfaces();
+  const Mat4 matrix = transform.matrix();
+  // A uniform scale leaves normals pointing the same way, only the turn
+  // applies to them.
+  const Mat4 turn = Mat4::rotation_y(transform.yaw);
+  if (place) {
+    out.placed.resize(n);
+    out.placed_vertex_normals.resize(n);
+    out.placed_face_normals.resize(nfaces);
+    out.world = out.placed.data();
+    out.vertex_normals = out.placed_vertex_normals.data();
+    out.face_normals = out.placed_face_normals.data();
+  } else {
+    out.world = model->verts();
+    out.vertex_normals = model->vertex_normals();
+    out.face_normals = model->face_normals();
+  }
+  out.screen.resize(n);
+  const int chunks = (n + vertices_per_chunk - 1) / vertices_per_chunk;
+  parallel_for(chunks, threads, [&](int chunk, int) {
+    int begin = chunk * vertices_per_chunk;
+    int end = std::min(n, begin + vertices_per_chunk);
+    if (place) {
+      matrix.transform(model->verts() + begin, out.placed.data() + begin,
+                       end - begin);
+      turn.transform(model->vertex_normals() + begin,
+                     out.placed_vertex_normals.data() + begin, end - begin);
+    }
+    to_screen(out.world, out.screen.data(), begin, end, width, height);
+  });
+  if (place) {
+    const int face_chunks = (nfaces + vertices_per_chunk - 1) /
+                            vertices_per_chunk;
+    parallel_for(face_chunks, threads, [&](int chunk, int) {
+      int begin = chunk * vertices_per_chunk;
+      int end = std::min(nfaces, begin + vertices_per_chunk);
+      turn.transform(model->face_normals() + begin,
+                     out.placed_face_normals.data() + begin, end - begin);
+    });
+  }
+}
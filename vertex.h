@@ -0,0 +1,51 @@
+#ifndef __VERTEX_H__
+#define __VERTEX_H__
+
+#include "geometry.h"
+#include "model.h"
+#include <cmath>
+#include <vector>
+
+// Placement of the model in the world, applied by the vertex stage: a turn of
+// `yaw` radians about the vertical axis, a uniform scale by `zoom`, then a
+// move by `offset`. The defaults leave the model where it is and skip the
+// transform entirely.
+struct ModelTransform {
+  float yaw = 0;
+  float zoom = 1;
+  Vec3f offset;
+
+  bool identity() const {
+    return yaw == 0 && zoom == 1 && offset.x == 0 && offset.y == 0 &&
+           offset.z == 0;
+  }
+  Mat4 matrix() const {
+    return Mat4::translation(offset) * Mat4::scale(zoom) *
+           Mat4::rotation_y(yaw);
+  }
+  Vec3f apply(const Vec3f &v) const { return matrix().transform(v); }
+};
+
+// Per frame output of the vertex stage, indexed like Model::verts(). Every
+// vertex is transformed exactly once here, however many faces share it, and
+// triangle setup only looks results up.
+struct VertexBuffer {
+  const Vec3f *world = nullptr; // positions lighting is computed from
+  std::vector<Vec3f> screen;    // world2screen() of every vertex
+  // transformed positions world points at, unused for the identity
+  std::vector<Vec3f> placed;
+  // The model's unit face and vertex normals, turned with it. For the
+  // identity these are the model's own arrays and cost nothing per frame.
+  const Vec3f *face_normals = nullptr;
+  const Vec3f *vertex_normals = nullptr;
+  std::vector<Vec3f> placed_face_normals, placed_vertex_normals;
+};
+
+// Runs the vertex stage for the whole model on `threads` workers, two
+// vertices per SSE2 instruction where available. Buffers in out are reused
+// from frame to frame.
+void process_vertices(const Model *model, int width, int height,
+                      VertexBuffer &out, int threads = 1,
+                      const ModelTransform &transform = ModelTransform());
+
+#endif //__VERTEX_H__
@@ -0,0 +1,305 @@
+#include "wireframe.h"
+#include "framebuffer.h"
+#include "parallel.h"
+#include "stats.h"
+#include "vertex.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+namespace {
+
+// A line in the form the kernel steps it. Step i is at
+//   major = start + i * step along the longer axis,
+//   minor = start + floor((2 i dminor + dmajor) / (2 dmajor)) * step
+// along the other, for i in [0, n] with n = dmajor.
+struct Segment {
+  int x0, y0;
+  int sx, sy;   // +1 or -1
+  int adx, ady; // |x1 - x0|, |y1 - y0|
+  int i0, i1;   // steps left after clipping to the image
+};
+
+Segment make_segment(int x0, int y0, int x1, int y1) {
+  Segment s;
+  s.x0 = x0, s.y0 = y0;
+  s.sx = x1 < x0 ? -1 : 1;
+  s.sy = y1 < y0 ? -1 : 1;
+  s.adx = std::abs(x1 - x0);
+  s.ady = std::abs(y1 - y0);
+  s.i0 = 0;
+  s.i1 = std::max(s.adx, s.ady);
+  return s;
+}
+
+// Steps [first, last] with the minor offset floor((2 i dmin + dmaj) / (2
+// dmaj)) within [lo, hi]. The offset never decreases, so they are a range.
+void minor_range(int64_t dmin, int64_t dmaj, int64_t lo, int64_t hi,
+                 int64_t &first, int64_t &last) {
+  if (dmin == 0) {
+    if (lo > 0 || hi < 0)
+      first = 1, last = 0;
+    return;
+  }
+  // offset >= lo from step ceil((2 lo dmaj - dmaj) / (2 dmin))
+  if (lo > 0) {
+    int64_t num = 2 * lo * dmaj - dmaj, den = 2 * dmin;
+    first = std::max(first, (num + den - 1) / den);
+  }
+  // offset <= hi until the step before offset hi + 1 is reached
+  int64_t num = 2 * (hi + 1) * dmaj - dmaj, den = 2 * dmin;
+  last = std::min(last, hi < 0 ? (int64_t)-1 : (num + den - 1) / den - 1);
+}
+
+// Offsets along an axis that keep start + offset * step within [lo, hi].
+inline void offsets(int start, int step, int lo, int hi, int64_t &olo,
+                    int64_t &ohi) {
+  if (step > 0)
+    olo = (int64_t)lo - start, ohi = (int64_t)hi - start;
+  else
+    olo = (int64_t)start - hi, ohi = (int64_t)start - lo;
+}
+
+// Narrows [s.i0, s.i1] to the steps inside [xlo, xhi] x [ylo, yhi] and
+// returns false when none are left.
+bool clip_steps(const Segment &s, int xlo, int ylo, int xhi, int yhi,
+                int &i0, int &i1) {
+  const bool xmajor = s.adx >= s.ady;
+  const int64_t dmaj = xmajor ? s.adx : s.ady, dmin = xmajor ? s.ady : s.adx;
+  int64_t first = s.i0, last = s.i1;
+  int64_t lo, hi;
+  // major axis: the offset is the step itself
+  if (xmajor)
+    offsets(s.x0, s.sx, xlo, xhi, lo, hi);
+  else
+    offsets(s.y0, s.sy, ylo, yhi, lo, hi);
+  first = std::max(first, lo);
+  last = std::min(last, hi);
+  if (first > last)
+    return false;
+  if (dmaj == 0) {
+    // a single point, the major test covered one axis
+    if (xmajor)
+      offsets(s.y0, s.sy, ylo, yhi, lo, hi);
+    else
+      offsets(s.x0, s.sx, xlo, xhi, lo, hi);
+    if (lo > 0 || hi < 0)
+      return false;
+  } else {
+    if (xmajor)
+      offsets(s.y0, s.sy, ylo, yhi, lo, hi);
+    else
+      offsets(s.x0, s.sx, xlo, xhi, lo, hi);
+    minor_range(dmin, dmaj, lo, hi, first, last);
+  }
+  if (first > last)
+    return false;
+  i0 = (int)first, i1 = (int)last;
+  return true;
+}
+
+// Cohen-Sutherland outcode of a point against the window.
+inline int outcode(int x, int y, int xlo, int ylo, int xhi, int yhi) {
+  return (x < xlo) | (x > xhi) << 1 | (y < ylo) << 2 | (y > yhi) << 3;
+}
+
+// Sets up the line and clips it to the image, false when nothing is left.
+bool clip_line(int x0, int y0, int x1, int y1, int width, int height,
+               Segment &s) {
+  int c0 = outcode(x0, y0, 0, 0, width - 1, height - 1);
+  int c1 = outcode(x1, y1, 0, 0, width - 1, height - 1);
+  if (c0 & c1)
+    return false;
+  s = make_segment(x0, y0, x1, y1);
+  if (!(c0 | c1))
+    return true;
+  return clip_steps(s, 0, 0, width - 1, height - 1, s.i0, s.i1);
+}
+
+// Plots steps [i0, i1] of the segment, which must lie inside the image.
+template <class FB>
+void plot(const FB &fb, const Segment &s, int i0, int i1,
+          typename FB::Pixel pixel) {
+  const bool xmajor = s.adx >= s.ady;
+  const int dmaj = xmajor ? s.adx : s.ady, dmin = xmajor ? s.ady : s.adx;
+  if (dmaj == 0) {
+    fb.set(s.x0, s.y0, pixel);
+    return;
+  }
+  // Minor offset and the remainder of the closed form at step i0, then the
+  // usual Bresenham error stepping from there.
+  int64_t num = 2 * (int64_t)i0 * dmin + dmaj;
+  int q = (int)(num / (2 * (int64_t)dmaj));
+  int err = (int)(num % (2 * (int64_t)dmaj));
+  const int two_dmaj = 2 * dmaj, two_dmin = 2 * dmin;
+  if (xmajor) {
+    int x = s.x0 + i0 * s.sx, y = s.y0 + q * s.sy;
+    for (int i = i0; i <= i1; i++, x += s.sx) {
+      fb.set(x, y, pixel);
+      err += two_dmin;
+      if (err >= two_dmaj)
+        err -= two_dmaj, y += s.sy;
+    }
+  } else {
+    int y = s.y0 + i0 * s.sy, x = s.x0 + q * s.sx;
+    for (int i = i0; i <= i1; i++, y += s.sy) {
+      fb.set(x, y, pixel);
+      err += two_dmin;
+      if (err >= two_dmaj)
+        err -= two_dmaj, x += s.sx;
+    }
+  }
+}
+
+// Row of step i.
+inline int row_at(const Segment &s, int i) {
+  if (s.adx < s.ady)
+    return s.y0 + i * s.sy;
+  if (s.adx == 0)
+    return s.y0;
+  int64_t q = (2 * (int64_t)i * s.ady + s.adx) / (2 * (int64_t)s.adx);
+  return s.y0 + (int)q * s.sy;
+}
+
+// Edges per binning chunk, same trade off as the tiled mesh path.
+const int edges_per_chunk = 16384;
+// Vertices per parallel item when deduplicating.
+const int vertices_per_chunk = 4096;
+
+struct Chunk {
+  std::vector<Segment> segments;
+  std::vector<std::vector<int>> bins;
+};
+
+} // namespace
+
+void build_edges(const Model *model, std::vector<Edge> &edges, int threads) {
+  STAT_SCOPE(STAGE_SETUP);
+  const int nverts = model->nverts(), nfaces = model->nfaces();
+
+  // Every face edge is filed under its lower vertex, in a compressed table
+  // of per vertex lists, which then only need a short sort each.
+  std::vector<int> start(nverts + 1, 0);
+  auto each_edge = [&](auto fn) {
+    for (int i = 0; i < nfaces; i++) {
+      Face face = model->face(i);
+      for (int j = 0; j < face.size(); j++) {
+        int a = face[j], b = face[(j + 1) % face.size()];
+        if (a != b && a >= 0 && b >= 0 && a < nverts && b < nverts)
+          fn(std::min(a, b), std::max(a, b));
+      }
+    }
+  };
+  each_edge([&](int lo, int) { start[lo + 1]++; });
+  for (int v = 0; v < nverts; v++)
+    start[v + 1] += start[v];
+  std::vector<int> fill(start.begin(), start.end() - 1);
+  std::vector<int> upper(start[nverts]);
+  each_edge([&](int lo, int hi) { upper[fill[lo]++] = hi; });
+
+  // Sort and deduplicate every list, then pack what is left.
+  const int chunks = (nverts + vertices_per_chunk - 1) / vertices_per_chunk;
+  std::vector<int> kept(nverts);
+  parallel_for(chunks, threads, [&](int c, int) {
+    int end = std::min(nverts, (c + 1) * vertices_per_chunk);
+    for (int v = c * vertices_per_chunk; v < end; v++) {
+      int *first = upper.data() + start[v], *last = upper.data() + start[v + 1];
+      std::sort(first, last);
+      kept[v] = int(std::unique(first, last) - first);
+    }
+  });
+  edges.clear();
+  for (int v = 0; v < nverts; v++)
+    for (int k = 0; k < kept[v]; k++)
+      edges.push_back(Edge{v, upper[start[v] + k]});
+}
+
+void draw_line(TGAImage &image, const TGAColor &color, int x0, int y0, int x1,
+               int y1) {
+  Segment s;
+  if (!clip_line(x0, y0, x1, y1, image.get_width(), image.get_height(), s))
+    return;
+  with_framebuffer(image, [&](const auto &fb) {
+    plot(fb, s, s.i0, s.i1, fb.pack(color));
+  });
+}
+
+void wireframe(const Model *model, const std::vector<Edge> &edges,
+               const TGAColor &color, TGAImage &image, const RenderOptions &opts,
+               RenderContext &context) {
+  const int width = image.get_width(), height = image.get_height();
+  STAT_ADD(STAT_FRAMES, 1);
+  VertexBuffer &vertices = context.vertices;
+  process_vertices(model, width, height, vertices, opts.threads,
+                   opts.transform);
+  const Vec3f *screen = vertices.screen.data();
+  const int nedges = (int)edges.size();
+
+  auto segment = [&](const Edge &e, Segment &s) {
+    const Vec3f &a = screen[e.a], &b = screen[e.b];
+    return clip_line(int(a.x), int(a.y), int(b.x), int(b.y), width, height, s);
+  };
+
+  with_framebuffer(image, [&](const auto &fb) {
+    const auto pixel = fb.pack(color);
+    const int workers = resolve_threads(opts.threads);
+    if (workers == 1) {
+      STAT_SCOPE(STAGE_RASTER);
+      Segment s;
+      for (const Edge &e : edges)
+        if (segment(e, s))
+          plot(fb, s, s.i0, s.i1, pixel);
+      return;
+    }
+
+    // Bin clipped lines into horizontal bands, chunks of edges in parallel.
+    const int nbands = std::min(height, workers * 4);
+    const int band = (height + nbands - 1) / nbands;
+    const int nchunks = (nedges + edges_per_chunk - 1) / edges_per_chunk;
+    std::vector<Chunk> &chunks = context.keep<std::vector<Chunk>>();
+    chunks.resize(nchunks);
+    {
+      STAT_SCOPE(STAGE_SETUP);
+      parallel_for(nchunks, workers, [&](int c, int) {
+        Chunk &chunk = chunks[c];
+        chunk.segments.clear();
+        chunk.bins.resize(nbands);
+        for (std::vector<int> &bin : chunk.bins)
+          bin.clear();
+        int end = std::min(nedges, (c + 1) * edges_per_chunk);
+        Segment s;
+        for (int i = c * edges_per_chunk; i < end; i++) {
+          if (!segment(edges[i], s))
+            continue;
+          int ya = row_at(s, s.i0), yb = row_at(s, s.i1);
+          int index = (int)chunk.segments.size();
+          chunk.segments.push_back(s);
+          for (int b = std::min(ya, yb) / band; b <= std::max(ya, yb) / band;
+               b++)
+            chunk.bins[b].push_back(index);
+        }
+      });
+    }
+
+    // Each band redraws the steps of its lines that fall in its rows.
+    STAT_SCOPE(STAGE_RASTER);
+    parallel_for(nbands, workers, [&](int b, int) {
+      int ylo = b * band, yhi = std::min(height, ylo + band) - 1;
+      for (const Chunk &chunk : chunks)
+        for (int index : chunk.bins[b]) {
+          const Segment &s = chunk.segments[index];
+          int i0, i1;
+          if (clip_steps(s, 0, ylo, width - 1, yhi, i0, i1))
+            plot(fb, s, i0, i1, pixel);
+        }
+    });
+  });
+}
+
+void wireframe(const Model *model, const TGAColor &color, TGAImage &image,
+               const RenderOptions &opts) {
+  std::vector<Edge> edges;
+  build_edges(model, edges, opts.threads);
+  RenderContext context;
+  wireframe(model, edges, color, image, opts, context);
+}
@@ -0,0 +1,45 @@
+#ifndef __WIREFRAME_H__
+#define __WIREFRAME_H__
+
+#include "model.h"
+#include "raster.h"
+#include "tgaimage.h"
+#include <vector>
+
+// Whole mesh wireframes.
+//
+// Lines are drawn by an integer Bresenham kernel in closed form: pixel i of a
+// line is a function of i alone, so a line can be started at any step with
+// no drift. Clipping therefore never moves endpoints. Lines are trivially
+// accepted or rejected by Cohen-Sutherland outcodes, and the rest are cut to
+// the run of steps inside the window. A line comes out pixel for pixel the
+// same however it is clipped, and screen bands drawn by different workers
+// join seamlessly.
+
+// One mesh edge, a < b.
+struct Edge {
+  int a, b;
+};
+
+// Collects every edge of every face once, however many faces share it.
+// Edges only depend on the model, so callers drawing many frames keep the
+// list.
+void build_edges(const Model *model, std::vector<Edge> &edges,
+                 int threads = 1);
+
+// Bresenham line from (x0, y0) to (x1, y1), both ends included, clipped to
+// the image.
+void draw_line(TGAImage &image, const TGAColor &color, int x0, int y0, int x1,
+               int y1);
+
+// Draws every edge of the model through the vertex stage (opts.transform
+// applies, lighting and depth do not). With opts.threads != 1 the screen is
+// cut into horizontal bands drawn in parallel, each line binned to the bands
+// it crosses.
+void wireframe(const Model *model, const std::vector<Edge> &edges,
+               const TGAColor &color, TGAImage &image, const RenderOptions &opts,
+               RenderContext &context);
+void wireframe(const Model *model, const TGAColor &color, TGAImage &image,
+               const RenderOptions &opts = RenderOptions());
+
+#endif //__WIREFRAME_H__